@@ -1,8 +1,18 @@
 #include "include/AsyncLog.h"
+#include "include/AsyncLogWriter.h"
+#include "include/CurrentThread.h"
 #include "include/FixedBuffer.h"
 #include "include/LogFile.h"
+#include "include/Logger.h"
+#include "include/RepeatCollapser.h"
+#include "include/TscClock.h"
 
+#include <algorithm>
+#include <charconv>
+#include <cmath>
 #include <condition_variable>
+#include <cstring>
+#include <ctime>
 #include <iostream>
 #include <thread>
 #include <filesystem>
@@ -10,51 +20,255 @@
 #include <memory>
 #include <mutex>
 #include <vector>
-#include <sys/prctl.h>
 
 
 namespace doggy
 {
 
-// 使用constexpr完成编译时计算
-constexpr size_t ASYNC_LOG_BUFFER_SIZE = 4000*1024;
+// 自动调节时缓冲区容量的下限
+constexpr size_t ASYNC_LOG_MIN_TUNED_BUFFER_SIZE = 64*1024;
+// 高优先级(WARN及以上)日志的缓冲区大小
+constexpr size_t ASYNC_LOG_URGENT_BUFFER_SIZE = 64*1024;
 
-class AsyncLogImpl
+namespace detail
+{
+// 以"%Y-%m-%d %H:%M:%S.毫秒"格式化当前时刻
+size_t FormatNow(char* buf, size_t size)
+{
+    auto now = std::chrono::system_clock::now();
+    auto tt = std::chrono::system_clock::to_time_t(now);
+    auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(now.time_since_epoch()).count() % 1000;
+    std::tm tm;
+    localtime_r(&tt, &tm);
+    size_t len = std::strftime(buf, size, "%Y-%m-%d %H:%M:%S", &tm);
+    return len + std::snprintf(buf + len, size - len, ".%03d", static_cast<int>(ms));
+}
+
+} // end namespace detail
+
+class AsyncLogImpl final : public detail::WriterTask
 {
 public:
-    AsyncLogImpl(const std::filesystem::path& dir_path, int flush_interval_s)
+    AsyncLogImpl(const std::filesystem::path& dir_path, const AsyncLogOptions& options)
         : running_(true),
           dir_path_(dir_path),
-          thread_(&AsyncLogImpl::DoBackgroundWork,this),
           notified(false),
-          flush_interval_s_(flush_interval_s),
-          cur_buf_(std::make_unique<Buffer>()),
-          next_buf_(std::make_unique<Buffer>())
-    {}
+          // flush间隔不足1ms时后台线程会不停地交换缓冲区空转
+          flush_interval_(std::max(options.flush_interval, std::chrono::milliseconds(1))),
+          wake_bytes_(options.wake_bytes),
+          max_delay_(std::max(options.max_delay, std::chrono::milliseconds(0))),
+          durable_(options.durable),
+          sync_latency_(options.sync_latency),
+          file_options_(options.file),
+          sequence_numbers_(options.sequence_numbers),
+          max_buffer_size_(std::max<size_t>(options.buffer_size, MIN_FIXEDBUFFER)),
+          buffer_size_(max_buffer_size_),
+          buffer_count_(std::max<size_t>(options.buffer_count, 4)),
+          high_water_(std::max<size_t>(options.high_water, 2)),
+          auto_tune_(options.auto_tune),
+          memory_limit_(options.memory_limit > 0 ? options.memory_limit : max_buffer_size_ * high_water_),
+          last_round_(std::chrono::steady_clock::now()),
+          cur_buf_(NewBuffer(buffer_size_)),
+          next_buf_(NewBuffer(buffer_size_)),
+          cur_urgent_buf_(NewBuffer(ASYNC_LOG_URGENT_BUFFER_SIZE)),
+          writer_(options.writer),
+          spare_buf_1_(NewBuffer(buffer_size_)),
+          spare_buf_2_(NewBuffer(buffer_size_)),
+          urgent_spare_(NewBuffer(ASYNC_LOG_URGENT_BUFFER_SIZE)),
+          last_flush_(std::chrono::steady_clock::now())
+    {
+        if(options.collapse_repeats)
+        {
+            collapser_ = std::make_unique<RepeatCollapser>(sequence_numbers_);
+        }
+        spare_buf_1_->Bzero();
+        spare_buf_2_->Bzero();
+        // 常驻数量超出4个的部分预先分配到缓冲池中
+        while(free_buffers_.size() + 4 < buffer_count_)
+        {
+            free_buffers_.push_back(NewBuffer(buffer_size_));
+            free_buffers_.back()->Bzero();
+        }
+        // 后台线程必须在其余成员初始化完成之后再启动
+        if(writer_)
+        {
+            std::lock_guard<std::mutex> lg(cv_m_);
+            writer_sleeping_ = true;
+            sleep_deadline_ = NextDeadline(last_flush_);
+            writer_->Attach(this, sleep_deadline_);
+        }
+        else
+        {
+            thread_ = std::thread(&AsyncLogImpl::DoBackgroundWork, this);
+        }
+    }
 
     // 标识AsyncLog是否正在运行
     std::atomic<bool> running_;
     // 日志文件的输出目录
-    const std::filesystem::path dir_path_; 
-    // 负责将缓存区中日志内容写入文件的后台线程
+    const std::filesystem::path dir_path_;
+    // 负责将缓存区中日志内容写入文件的后台线程, 使用共享写线程时不创建
     std::thread thread_;
     // 同步相关设施
     std::mutex cv_m_;
     std::condition_variable cv_;
     bool notified;
+    // 后台线程正在cv_上睡眠时为true, 由cv_m_保护; 前台线程只在它为true时才notify,
+    // 唤醒一次后立即清除, 避免每条日志都付出notify_one的代价
+    bool writer_sleeping_ = false;
+    // 后台线程本次睡眠的截止时刻
+    std::chrono::steady_clock::time_point sleep_deadline_;
+
+    const std::chrono::milliseconds flush_interval_;
+    // 自适应唤醒策略的参数
+    const size_t wake_bytes_;
+    const std::chrono::milliseconds max_delay_;
+    // 自上次交换缓冲区以来追加的字节数, 以及其中最早一条日志的追加时刻(仅在启用max_delay_时记录)
+    size_t pending_bytes_ = 0;
+    std::chrono::steady_clock::time_point oldest_pending_;
+
+    // 持久化(组提交)相关设施, 均由cv_m_保护
+    // 以累计写入的字节数作为日志序号: appended_lsn_为已追加的位置, durable_lsn_为最近一次成功的fdatasync覆盖到的位置,
+    // settled_lsn_为已有结果(落盘、被丢弃或者fdatasync失败)的位置
+    const bool durable_;
+    const std::chrono::microseconds sync_latency_;
+    std::condition_variable durable_cv_;
+    uint64_t appended_lsn_ = 0;
+    uint64_t durable_lsn_ = 0;
+    uint64_t settled_lsn_ = 0;
+    // 未能落盘的区间的起点, 单调递增; 只在有等待者时记录, 最后一个等待者离开时清空
+    std::vector<uint64_t> lost_lsns_;
+    uint64_t durable_waiters_ = 0;
+    // 自上一次组提交以来到达的等待者数量, 以及其中第一个等待者的到达时刻
+    uint64_t sync_waiters_ = 0;
+    std::chrono::steady_clock::time_point first_waiter_time_;
+    // 后台线程退出后置为true, 此后等待者不再阻塞
+    bool stopped_ = false;
+    AsyncLogSyncStats sync_stats_;
+
+    // 缓冲区中日志的序号范围: 第一条和最后一条日志的序号与日志条数, 以及第一条日志的起始位置(appended_lsn_)
+    // 高优先级日志与普通日志共用一套序号, 因此普通缓冲区中的序号可能不连续, last不能由first和records推算
+    struct SeqRange
+    {
+        uint64_t first;
+        uint64_t last;
+        uint64_t records;
+        uint64_t lsn;
+    };
+
+    // 创建日志文件时使用的写入方式
+    const LogFileOptions file_options_;
+
+    // 日志序号, 由cv_m_保护: next_seq_为下一条日志的序号, cur_seqs_为cur_buf_中日志的序号范围
+    const bool sequence_numbers_;
+    uint64_t next_seq_ = 1;
+    SeqRange cur_seqs_{1, 0, 0, 0};
+    // 丢弃统计, 由cv_m_保护
+    AsyncLogLossStats loss_stats_;
+
+    // 缓冲区的配置, 由cv_m_保护, 只由后台线程修改:
+    // max_buffer_size_为配置的容量, 自动调节时buffer_size_在[ASYNC_LOG_MIN_TUNED_BUFFER_SIZE, max_buffer_size_]之间变化
+    const size_t max_buffer_size_;
+    size_t buffer_size_;
+    size_t buffer_count_;
+    size_t high_water_;
+    const bool auto_tune_;
+    const size_t memory_limit_;
+    // 本实例所有缓冲区(两个通道、缓冲池和后台线程持有的)的容量之和, 必须先于各个缓冲区构造、后于它们析构;
+    // 自动调节时普通日志需要新的缓冲区而会超出memory_limit_时, 这条日志被丢弃; 高优先级日志不受限制, 但计入用量
+    std::atomic<size_t> memory_used_{0};
+    // 因超出内存上限而在前台被丢弃的普通日志的序号区间, 由cv_m_保护; 后台线程每轮取走并在文件中留下缺口标记
+    struct DropRange
+    {
+        uint64_t first = 0;
+        uint64_t last = 0;
+        uint64_t records = 0;
+        size_t bytes = 0;
+        // 第一条被丢弃的日志的起始位置(appended_lsn_)
+        uint64_t lsn = 0;
+    };
+    DropRange over_limit_;
+    // 自动调节的依据: 折算到每个flush间隔的写出字节数的滑动平均, 以及衰减的单轮缓冲区数峰值
+    double bytes_per_interval_ = 0;
+    double peak_buffers_ = 0;
+    uint64_t retunes_ = 0;
+    // 上一轮写出的时刻, 只由后台线程使用
+    std::chrono::steady_clock::time_point last_round_;
 
-    const std::chrono::seconds flush_interval_s_;
-    
     // 缓存区
-    typedef FixedBuffer<ASYNC_LOG_BUFFER_SIZE> Buffer;
+    typedef DynamicBuffer Buffer;
     typedef std::unique_ptr<Buffer> BufferPtr;
 
     BufferPtr cur_buf_;
     BufferPtr next_buf_;
+    // 缓冲池: 常驻数量超出4个的空闲缓冲区, 由cv_m_保护
+    std::vector<BufferPtr> free_buffers_;
     std::vector<BufferPtr> buffers_;
+    // buffers_中每个缓冲区的序号范围, 与buffers_一一对应
+    std::vector<SeqRange> buffer_seqs_;
+
+    // 高优先级通道: WARN及以上的日志写入独立的小缓冲区, 立即唤醒后台线程并先于普通日志写出,
+    // 且永远不会被丢弃; 当前缓冲区写满时追加新的缓冲区, 超过容量的日志使用单独分配的足够大的缓冲区
+    typedef DynamicBuffer UrgentBuffer;
+    typedef std::unique_ptr<UrgentBuffer> UrgentBufferPtr;
+
+    UrgentBufferPtr cur_urgent_buf_;
+    std::vector<UrgentBufferPtr> urgent_buffers_;
+
+    // 启用collapse_repeats时合并连续重复的日志, 只由后台线程使用
+    std::unique_ptr<RepeatCollapser> collapser_;
+    // Logger使用TSC时钟时, 后台线程在写文件前将tick占位符换算为墙上时间; 只由后台线程使用
+    bool convert_tsc_ = false;
+    TscTimestampConverter tsc_converter_;
+    std::string tsc_scratch_;
+
+    // 共享写线程, 为空时使用独占的后台线程
+    std::shared_ptr<AsyncLogWriter> writer_;
+    // 写出侧的状态, 只由正在处理本实例的线程访问:
+    // 两个空闲缓冲区, 待写出的缓冲区及其序号范围, 高优先级通道待写出的缓冲区与一个空闲缓冲区
+    BufferPtr spare_buf_1_;
+    BufferPtr spare_buf_2_;
+    std::vector<BufferPtr> buffers_to_write_;
+    std::vector<SeqRange> seqs_to_write_;
+    std::vector<UrgentBufferPtr> urgent_to_write_;
+    UrgentBufferPtr urgent_spare_;
+    DropRange over_limit_to_write_;
+    // 上一次交换缓冲区的时刻, 由cv_m_保护
+    std::chrono::steady_clock::time_point last_flush_;
+
+    // 分配一个计入memory_used_的缓冲区
+    BufferPtr NewBuffer(size_t capacity);
+    // 在持有cv_m_时调用: 为一条日志分配序号, 启用sequence_numbers_时把"#序号 "写入buf并返回其长度
+    size_t TakeSeq(char (&buf)[24], uint64_t& seq);
+
+    // 在持有cv_m_时调用: 将一条日志追加到普通通道
+    void Append(std::string_view logline);
+    // 在持有cv_m_时调用: 阻塞直到lsn之前的日志有了结果, 返回它们是否都已落盘
+    bool WaitDurable(std::unique_lock<std::mutex>& lk, uint64_t lsn);
+    // 在持有cv_m_时调用: 若后台线程正在睡眠则唤醒它
+    void WakeWriter();
+    // 共享写线程: 检查是否到期, 到期时完成一轮写出, 返回下一次需要检查的时刻
+    std::chrono::steady_clock::time_point Service() override;
+    // 后台线程退出或者从共享写线程摘除之后, 写出剩余的日志
+    void Drain();
 
 private:
+    // 后台线程: 将一个缓冲区的内容写入文件, 启用collapse_repeats时经过RepeatCollapser
+    void WriteBuffer(LogFile& output, std::string_view data);
+    // 在持有cv_m_时调用: 计算后台线程下一次必须醒来的时刻
+    std::chrono::steady_clock::time_point NextDeadline(std::chrono::steady_clock::time_point last_flush) const;
     void DoBackgroundWork();
+    // 在持有cv_m_时调用: 交换前台缓冲区, 取得本轮需要落盘的位置与等待者数量
+    void SwapBuffers(uint64_t& sync_lsn, uint64_t& sync_batch);
+    // 在不持有cv_m_时调用: 将交换出来的缓冲区写入文件, 持久化模式下完成组提交
+    void WriteOut(uint64_t sync_lsn, uint64_t sync_batch);
+    // 后台线程: 复用容量符合当前配置的缓冲区, 否则分配一个新的
+    BufferPtr Recycle(BufferPtr buffer);
+    // 在持有cv_m_时调用: 根据本轮写出的字节数和缓冲区数调整缓冲区配置
+    void Retune(size_t round_bytes, size_t round_buffers);
+    // 组提交: 结算[settled_lsn_, lsn), 其中只有written之前的部分已写入文件, synced表示fdatasync是否成功;
+    // 唤醒等待者并记录本批次的大小
+    void CompleteSync(uint64_t written, uint64_t lsn, bool synced, uint64_t batch, std::chrono::microseconds cost);
 };
 
 } // end namespace doggy
@@ -62,7 +276,18 @@ private:
 using namespace doggy;
 
 AsyncLog::AsyncLog(const std::filesystem::path& dir_path, int flush_interval_s)
-    : impl_(std::make_unique<AsyncLogImpl>(dir_path, flush_interval_s))
+    : AsyncLog(dir_path, [flush_interval_s]
+      {
+          AsyncLogOptions options;
+          options.flush_interval = std::chrono::seconds(flush_interval_s);
+          return options;
+      }())
+{
+    // do nothing
+}
+
+AsyncLog::AsyncLog(const std::filesystem::path& dir_path, const AsyncLogOptions& options)
+    : impl_(std::make_unique<AsyncLogImpl>(dir_path, options))
 {
     // do nothing
 }
@@ -74,114 +299,696 @@ AsyncLog::~AsyncLog()
 
 void AsyncLog::Stop()
 {
-    impl_->running_.store(false);
+    bool was_running;
+    {
+        std::lock_guard<std::mutex> lg(impl_->cv_m_);
+        was_running = impl_->running_.exchange(false);
+        impl_->notified = true;
+        impl_->WakeWriter();
+    }
 
     if(impl_->thread_.joinable())
     {
         impl_->thread_.join();
     }
+    else if(was_running && impl_->writer_)
+    {
+        // 等待共享写线程完成正在进行的写出, 剩余的日志在调用线程中写出
+        impl_->writer_->Detach(impl_.get());
+        impl_->Drain();
+    }
 }
 
 void AsyncLog::Append(const std::string_view logline)
 {
     // 临界区
     std::lock_guard<std::mutex> lg(impl_->cv_m_);
+    impl_->Append(logline);
+}
+
+void AsyncLog::AppendLevel(const std::string_view logline, LogLevel level)
+{
+    if(level < LogLevel::WARN)
+    {
+        Append(logline);
+        return;
+    }
+    // 临界区
+    std::lock_guard<std::mutex> lg(impl_->cv_m_);
+    uint64_t seq;
+    char seq_buf[24];
+    const size_t seq_len = impl_->TakeSeq(seq_buf, seq);
+    const size_t record_size = seq_len + logline.size();
+    impl_->appended_lsn_ += record_size;
+    if(impl_->cur_urgent_buf_->Avail() < record_size)
+    {
+        // 超过缓冲区容量的日志单独使用一个足够大的缓冲区, 这个通道不能截断日志
+        impl_->urgent_buffers_.emplace_back(std::move(impl_->cur_urgent_buf_));
+        impl_->cur_urgent_buf_ = impl_->NewBuffer(std::max(record_size, ASYNC_LOG_URGENT_BUFFER_SIZE));
+    }
+    impl_->cur_urgent_buf_->Append(std::string_view(seq_buf, seq_len));
+    impl_->cur_urgent_buf_->Append(logline);
+    // 高优先级日志总是立即唤醒后台线程
+    impl_->notified = true;
+    impl_->WakeWriter();
+}
+
+bool AsyncLog::AppendDurable(const std::string_view logline)
+{
+    // 追加与登记在同一个临界区内完成, 后台线程对这条日志的处理结果一定会被等待者看到
+    std::unique_lock<std::mutex> lk(impl_->cv_m_);
+    impl_->Append(logline);
+    if(!impl_->durable_)
+    {
+        return false;
+    }
+    return impl_->WaitDurable(lk, impl_->appended_lsn_);
+}
+
+bool AsyncLog::WaitDurable()
+{
+    if(!impl_->durable_)
+    {
+        return false;
+    }
+    std::unique_lock<std::mutex> lk(impl_->cv_m_);
+    return impl_->WaitDurable(lk, impl_->appended_lsn_);
+}
+
+AsyncLogSyncStats AsyncLog::GetSyncStats() const
+{
+    std::lock_guard<std::mutex> lg(impl_->cv_m_);
+    return impl_->sync_stats_;
+}
+
+AsyncLogLossStats AsyncLog::GetLossStats() const
+{
+    std::lock_guard<std::mutex> lg(impl_->cv_m_);
+    AsyncLogLossStats stats = impl_->loss_stats_;
+    stats.records = impl_->next_seq_ - 1;
+    return stats;
+}
+
+AsyncLogBufferStats AsyncLog::GetBufferStats() const
+{
+    std::lock_guard<std::mutex> lg(impl_->cv_m_);
+    AsyncLogBufferStats stats;
+    stats.buffer_size = impl_->buffer_size_;
+    stats.buffer_count = impl_->buffer_count_;
+    stats.high_water = impl_->high_water_;
+    stats.bytes_per_interval = static_cast<size_t>(impl_->bytes_per_interval_);
+    stats.retunes = impl_->retunes_;
+    return stats;
+}
+
+void AsyncLogImpl::Append(std::string_view logline)
+{
+    uint64_t seq;
+    char seq_buf[24];
+    const size_t seq_len = TakeSeq(seq_buf, seq);
+    const size_t record_size = seq_len + logline.size();
+    const uint64_t lsn = appended_lsn_;
+    appended_lsn_ += record_size;
+    // 这是本轮第一条日志: 若它的最大等待时长早于后台线程的睡眠截止时刻, 需要让后台线程重新计算截止时刻
+    if(pending_bytes_ == 0 && max_delay_.count() > 0)
+    {
+        oldest_pending_ = std::chrono::steady_clock::now();
+        if(oldest_pending_ + max_delay_ < sleep_deadline_)
+        {
+            WakeWriter();
+        }
+    }
+    pending_bytes_ += record_size;
     // 如果当前缓冲区还足够使用,则直接将日志内容拷贝到当前缓冲区
-    // 不主动唤醒异步写日志的后台线程
-    if(impl_->cur_buf_->Avail() >= logline.size())
+    // 不主动唤醒异步写日志的后台线程, 除非待写入字节数达到了唤醒阈值
+    if(cur_buf_->Avail() >= record_size)
     {
-        impl_->cur_buf_->Append(logline);
+        cur_buf_->Append(std::string_view(seq_buf, seq_len));
+        cur_buf_->Append(logline);
+        // 交换缓冲区之后的第一条日志确定本缓冲区的起点, 之间的序号可能已被高优先级日志占用
+        if(cur_seqs_.records == 0)
+        {
+            cur_seqs_.first = seq;
+            cur_seqs_.lsn = lsn;
+        }
+        cur_seqs_.last = seq;
+        ++cur_seqs_.records;
+        if(wake_bytes_ > 0 && pending_bytes_ >= wake_bytes_ && !notified)
+        {
+            notified = true;
+            WakeWriter();
+        }
     }
     else
     {
-        impl_->buffers_.emplace_back(std::move(impl_->cur_buf_));
-        if(impl_->next_buf_)
+        // 自动调节改变容量之前回收的缓冲区可能比当前配置小, 只使用容量足够的;
+        // 超过缓冲区容量的日志单独使用一个足够大的缓冲区
+        BufferPtr buffer;
+        if(next_buf_ && next_buf_->Capactiy() >= record_size)
         {
-            impl_->cur_buf_ = std::move(impl_->next_buf_);
+            buffer = std::move(next_buf_);
         }
-        else 
+        else if(!free_buffers_.empty() && free_buffers_.back()->Capactiy() >= record_size)
         {
-            impl_->cur_buf_ = std::make_unique<AsyncLogImpl::Buffer>();
+            buffer = std::move(free_buffers_.back());
+            free_buffers_.pop_back();
         }
-        impl_->cur_buf_->Append(logline);
-        impl_->notified = true;
-        impl_->cv_.notify_one();
+        else
+        {
+            const size_t capacity = std::max(record_size, buffer_size_);
+            if(auto_tune_ && memory_used_.load(std::memory_order_relaxed) + capacity > memory_limit_)
+            {
+                // 超出内存上限: 丢弃这条日志, 当前缓冲区保持不变, 唤醒后台线程尽快写出并归还缓冲区
+                if(over_limit_.records == 0)
+                {
+                    over_limit_.first = seq;
+                    over_limit_.lsn = lsn;
+                    ++loss_stats_.drop_events;
+                }
+                over_limit_.last = seq;
+                ++over_limit_.records;
+                over_limit_.bytes += record_size;
+                ++loss_stats_.dropped_records;
+                loss_stats_.dropped_bytes += record_size;
+                notified = true;
+                WakeWriter();
+                return;
+            }
+            buffer = NewBuffer(capacity);
+        }
+        buffers_.emplace_back(std::move(cur_buf_));
+        buffer_seqs_.push_back(cur_seqs_);
+        cur_seqs_ = {seq, seq, 1, lsn};
+        cur_buf_ = std::move(buffer);
+        cur_buf_->Append(std::string_view(seq_buf, seq_len));
+        cur_buf_->Append(logline);
+        notified = true;
+        WakeWriter();
+    }
+}
+
+bool AsyncLogImpl::WaitDurable(std::unique_lock<std::mutex>& lk, uint64_t lsn)
+{
+    if(settled_lsn_ >= lsn || stopped_)
+    {
+        return durable_lsn_ >= lsn;
+    }
+    // 登记之前结算的区间都在since之前; 之后结算的区间若从lsn之前开始丢失, 调用者等待的日志就没有全部落盘
+    const uint64_t since = settled_lsn_;
+    ++durable_waiters_;
+    // 第一个等待者负责唤醒后台线程开启组提交窗口, 后续等待者搭便车
+    if(sync_waiters_++ == 0)
+    {
+        first_waiter_time_ = std::chrono::steady_clock::now();
+        notified = true;
+        WakeWriter();
+    }
+    durable_cv_.wait(lk, [this, lsn]{ return settled_lsn_ >= lsn || stopped_; });
+    auto lost = std::lower_bound(lost_lsns_.begin(), lost_lsns_.end(), since);
+    const bool ok = settled_lsn_ >= lsn && (lost == lost_lsns_.end() || *lost >= lsn);
+    if(--durable_waiters_ == 0)
+    {
+        lost_lsns_.clear();
+    }
+    return ok;
+}
+
+size_t AsyncLogImpl::TakeSeq(char (&buf)[24], uint64_t& seq)
+{
+    seq = next_seq_++;
+    if(!sequence_numbers_)
+    {
+        return 0;
+    }
+    buf[0] = '#';
+    size_t len = std::to_chars(buf + 1, buf + sizeof(buf) - 1, seq).ptr - buf;
+    buf[len++] = ' ';
+    return len;
+}
+
+void AsyncLogImpl::WriteBuffer(LogFile& output, std::string_view data)
+{
+    if(convert_tsc_ && tsc_converter_.Convert(data, tsc_scratch_))
+    {
+        data = tsc_scratch_;
+    }
+    if(collapser_)
+    {
+        collapser_->Write(data, output);
+    }
+    else
+    {
+        output.Append(data);
+    }
+}
+
+void AsyncLogImpl::WakeWriter()
+{
+    if(writer_sleeping_)
+    {
+        writer_sleeping_ = false;
+        if(writer_)
+        {
+            writer_->Wake(this);
+        }
+        else
+        {
+            cv_.notify_one();
+        }
+    }
+}
+
+std::chrono::steady_clock::time_point AsyncLogImpl::NextDeadline(std::chrono::steady_clock::time_point last_flush) const
+{
+    auto deadline = last_flush + flush_interval_;
+    if(max_delay_.count() > 0 && pending_bytes_ > 0)
+    {
+        deadline = std::min(deadline, oldest_pending_ + max_delay_);
+    }
+    return deadline;
+}
+
+void AsyncLogImpl::CompleteSync(uint64_t written, uint64_t lsn, bool synced, uint64_t batch, std::chrono::microseconds cost)
+{
+    {
+        std::lock_guard<std::mutex> lg(cv_m_);
+        if(synced)
+        {
+            durable_lsn_ = std::max(durable_lsn_, written);
+        }
+        // [lost, lsn)中的日志没有落盘: 本批次丢弃了written之后的缓冲区, 或者整个批次的fdatasync失败
+        const uint64_t lost = synced ? std::max(written, settled_lsn_) : settled_lsn_;
+        if(lost < lsn)
+        {
+            ++sync_stats_.failures;
+            if(durable_waiters_ > 0)
+            {
+                lost_lsns_.push_back(lost);
+            }
+        }
+        settled_lsn_ = std::max(settled_lsn_, lsn);
+        ++sync_stats_.syncs;
+        sync_stats_.waiters += batch;
+        sync_stats_.max_batch = std::max(sync_stats_.max_batch, batch);
+        sync_stats_.sync_time += cost;
+        size_t bucket = 0;
+        for(uint64_t b = batch; b != 0 && bucket + 1 < sync_stats_.batch_histogram.size(); b >>= 1)
+        {
+            ++bucket;
+        }
+        ++sync_stats_.batch_histogram[bucket];
     }
+    durable_cv_.notify_all();
 }
 
 void AsyncLogImpl::DoBackgroundWork()
 {
     // 设置后台线程名字, 方便分线程观测程序的运行情况
-    prctl(PR_SET_NAME, "AsyncLog", 0, 0, 0);
-    
-    BufferPtr buf_1 = std::make_unique<Buffer>();
-    BufferPtr buf_2 = std::make_unique<Buffer>();
-    buf_1->Bzero();
-    buf_2->Bzero();
-
-    // 线程内缓存区
-    std::vector<BufferPtr> buffers_to_write;
+    CurrentThread::SetName("AsyncLog");
 
     while(running_)
     {
+        uint64_t sync_lsn = 0;
+        uint64_t sync_batch = 0;
         {// critical section: 互斥访问condition variable和前台线程缓存区
-            auto timeout = flush_interval_s_;
             std::unique_lock<std::mutex> lk(cv_m_);
-            cv_.wait_for(lk, timeout, [this]{return notified;});
-            
-            notified = false;
-
-            buffers_.emplace_back(std::move(cur_buf_));     
-            cur_buf_ = std::move(buf_1);
-            
-            std::swap(buffers_to_write,buffers_);
-            
-            if(!next_buf_)
+            // 每次醒来都重新计算截止时刻: 前台线程可能因为新到达的日志而要求提前醒来
+            while(!notified)
+            {
+                auto deadline = NextDeadline(last_flush_);
+                if(std::chrono::steady_clock::now() >= deadline)
+                {
+                    break;
+                }
+                writer_sleeping_ = true;
+                sleep_deadline_ = deadline;
+                cv_.wait_until(lk, deadline);
+                writer_sleeping_ = false;
+            }
+            // 组提交窗口: 从第一个等待者到达起再等待sync_latency_, 让更多等待者合并到同一次fdatasync
+            if(durable_ && sync_waiters_ > 0)
             {
-                next_buf_ = std::move(buf_2);
+                cv_.wait_until(lk, first_waiter_time_ + sync_latency_, [this]{ return !running_; });
             }
-            
+            SwapBuffers(sync_lsn, sync_batch);
         }// critical section end
 
-        auto output = doggy::LogFile::Create(dir_path_, false);
+        WriteOut(sync_lsn, sync_batch);
+    }
+    Drain();
+}
 
-        // 日志生产速度远大于日志消费速度,产生日志堆积
-        // 为避免日志缓存占用过多内存,直接抛弃部分日志
-        if(buffers_to_write.size() > 25)
+std::chrono::steady_clock::time_point AsyncLogImpl::Service()
+{
+    // 与DoBackgroundWork的一轮循环相同, 只是不在cv_上等待, 而是把截止时刻交给共享写线程的时间轮
+    uint64_t sync_lsn = 0;
+    uint64_t sync_batch = 0;
+    {
+        std::unique_lock<std::mutex> lk(cv_m_);
+        writer_sleeping_ = false;
+        if(!running_)
+        {
+            // 剩余的日志由Stop写出
+            return std::chrono::steady_clock::time_point::max();
+        }
+        auto now = std::chrono::steady_clock::now();
+        auto deadline = NextDeadline(last_flush_);
+        if(!notified && now < deadline)
         {
-            char buf[256];
-            // FIXME:时间函数补充
-            std::snprintf(buf,sizeof(buf),"Dropped log message at %s, %zd larger buffers\n",
-                "0", buffers_to_write.size()-2);
-            std::fputs(buf,stderr);
-            output->Append(buf);
-            buffers_to_write.erase(buffers_to_write.begin()+2, buffers_to_write.end());
+            writer_sleeping_ = true;
+            sleep_deadline_ = deadline;
+            return deadline;
         }
-        // 输出日志到文件
-        for(const auto& buffer : buffers_to_write)
+        if(durable_ && sync_waiters_ > 0 && now < first_waiter_time_ + sync_latency_)
         {
-            output->Append(buffer->ToStringView());
+            writer_sleeping_ = true;
+            sleep_deadline_ = first_waiter_time_ + sync_latency_;
+            return sleep_deadline_;
         }
-        if(buffers_to_write.size() > 2)
+        SwapBuffers(sync_lsn, sync_batch);
+    }
+
+    WriteOut(sync_lsn, sync_batch);
+
+    std::unique_lock<std::mutex> lk(cv_m_);
+    if(!running_)
+    {
+        return std::chrono::steady_clock::time_point::max();
+    }
+    if(notified)
+    {
+        return std::chrono::steady_clock::now();
+    }
+    writer_sleeping_ = true;
+    sleep_deadline_ = NextDeadline(last_flush_);
+    return sleep_deadline_;
+}
+
+void AsyncLogImpl::SwapBuffers(uint64_t& sync_lsn, uint64_t& sync_batch)
+{
+    notified = false;
+    last_flush_ = std::chrono::steady_clock::now();
+    pending_bytes_ = 0;
+    sync_lsn = appended_lsn_;
+    sync_batch = sync_waiters_;
+    sync_waiters_ = 0;
+
+    buffers_.emplace_back(std::move(cur_buf_));
+    buffer_seqs_.push_back(cur_seqs_);
+    cur_buf_ = std::move(spare_buf_1_);
+    cur_seqs_ = {next_seq_, 0, 0, appended_lsn_};
+
+    std::swap(buffers_to_write_,buffers_);
+    std::swap(seqs_to_write_,buffer_seqs_);
+    over_limit_to_write_ = over_limit_;
+    over_limit_ = DropRange();
+
+    if(cur_urgent_buf_->Size() > 0 || !urgent_buffers_.empty())
+    {
+        urgent_buffers_.emplace_back(std::move(cur_urgent_buf_));
+        cur_urgent_buf_ = urgent_spare_ ? std::move(urgent_spare_) : NewBuffer(ASYNC_LOG_URGENT_BUFFER_SIZE);
+        std::swap(urgent_to_write_, urgent_buffers_);
+    }
+
+    if(!next_buf_)
+    {
+        next_buf_ = std::move(spare_buf_2_);
+    }
+}
+
+void AsyncLogImpl::WriteOut(uint64_t sync_lsn, uint64_t sync_batch)
+{
+    auto output = doggy::LogFile::Create(dir_path_, false, file_options_);
+
+    // 每轮重新校准一次tick到墙上时间的映射; 切回SYSTEM之后缓冲区中可能还有带占位符的日志, 只要曾经使用过TSC就要换算
+    convert_tsc_ = Logger::TscClockUsed() && TscClock::Invariant();
+    if(convert_tsc_)
+    {
+        tsc_converter_.Recalibrate();
+    }
+
+    // 高优先级日志先于普通日志写出, 并且不参与下面的丢弃逻辑
+    for(auto& buffer : urgent_to_write_)
+    {
+        WriteBuffer(*output, buffer->ToStringView());
+        if(!urgent_spare_ && buffer->Capactiy() == ASYNC_LOG_URGENT_BUFFER_SIZE)
         {
-            buffers_to_write.resize(2);
+            buffer->Clear();
+            urgent_spare_ = std::move(buffer);
         }
+    }
+    urgent_to_write_.clear();
 
-        buf_1 = std::move(buffers_to_write[0]);
-        buf_1->Clear();
-        // 如果buf_2被move to next_buf, 那么buffers_to_write中至少有两个buffer
-        if(!buf_2)
+    // 日志生产速度远大于日志消费速度,产生日志堆积
+    // 为避免日志缓存占用过多内存,直接抛弃部分日志
+    // 堆积的缓冲区数超过高水位时, 丢弃的是第3个缓冲区起的所有普通日志, 在保留的日志之后写入缺口标记:
+    // 序号区间从第一条到最后一条被丢弃的普通日志, 覆盖全部被丢弃的序号; 区间内不属于普通通道的序号已经由高优先级通道写出
+    char drop_notice[512];
+    drop_notice[0] = '\0';
+    const size_t round_buffers = buffers_to_write_.size();
+    size_t round_bytes = 0;
+    for(const auto& buffer : buffers_to_write_)
+    {
+        round_bytes += buffer->Size();
+    }
+    // 本轮实际写入文件的位置: 发生丢弃时止于第一个被丢弃的缓冲区
+    uint64_t written_lsn = sync_lsn;
+    if(buffers_to_write_.size() > high_water_)
+    {
+        written_lsn = seqs_to_write_[2].lsn;
+        const uint64_t first_dropped = seqs_to_write_[2].first;
+        uint64_t last_dropped = first_dropped;
+        size_t dropped_bytes = 0;
+        uint64_t dropped_records = 0;
+        for(size_t i = 2; i < buffers_to_write_.size(); ++i)
         {
-            buf_2 = std::move(buffers_to_write[1]);
-            buf_2->Clear();
+            dropped_bytes += buffers_to_write_[i]->Size();
+            dropped_records += seqs_to_write_[i].records;
+            if(seqs_to_write_[i].records > 0)
+            {
+                last_dropped = seqs_to_write_[i].last;
+            }
         }
-        buffers_to_write.clear();
-        output->Flush();
+        char now[64];
+        detail::FormatNow(now, sizeof(now));
+        std::snprintf(drop_notice,sizeof(drop_notice),"Dropped %lu log records in %lu-%lu at %s, %zu bytes in %zu larger buffers\n",
+            static_cast<unsigned long>(dropped_records),
+            static_cast<unsigned long>(first_dropped), static_cast<unsigned long>(last_dropped),
+            now, dropped_bytes, buffers_to_write_.size()-2);
+        std::fputs(drop_notice,stderr);
+        buffers_to_write_.erase(buffers_to_write_.begin()+2, buffers_to_write_.end());
+        {
+            std::lock_guard<std::mutex> lg(cv_m_);
+            loss_stats_.dropped_records += dropped_records;
+            loss_stats_.dropped_bytes += dropped_bytes;
+            ++loss_stats_.drop_events;
+        }
+    }
+    // 输出日志到文件
+    for(const auto& buffer : buffers_to_write_)
+    {
+        WriteBuffer(*output, buffer->ToStringView());
+    }
+    // 前台因超出内存上限而丢弃的日志散布在本轮之中, 缺口标记写在本轮的普通日志之后
+    if(over_limit_to_write_.records > 0)
+    {
+        char now[64];
+        detail::FormatNow(now, sizeof(now));
+        size_t len = std::strlen(drop_notice);
+        std::snprintf(drop_notice + len, sizeof(drop_notice) - len, "Dropped %lu log records in %lu-%lu at %s, %zu bytes over the memory limit\n",
+            static_cast<unsigned long>(over_limit_to_write_.records),
+            static_cast<unsigned long>(over_limit_to_write_.first), static_cast<unsigned long>(over_limit_to_write_.last),
+            now, over_limit_to_write_.bytes);
+        std::fputs(drop_notice + len, stderr);
+        written_lsn = std::min(written_lsn, over_limit_to_write_.lsn);
+    }
+    if(drop_notice[0] != '\0')
+    {
+        // 缺口两侧的日志不再算作连续
+        if(collapser_)
+        {
+            collapser_->Finish(*output, true);
+        }
+        output->Append(drop_notice);
+    }
+    // 先调整配置再回收空闲缓冲区, 使它们按新的容量复用或重新分配
+    if(auto_tune_)
+    {
+        std::lock_guard<std::mutex> lg(cv_m_);
+        Retune(round_bytes, round_buffers);
+    }
+    spare_buf_1_ = Recycle(std::move(buffers_to_write_[0]));
+    // spare_buf_2_被move to next_buf时, 通常是前台用掉了next_buf_, buffers_to_write_中至少有两个buffer;
+    // 若next_buf_是因容量过时而被释放的, 这里按新的容量重新分配
+    if(!spare_buf_2_)
+    {
+        spare_buf_2_ = Recycle(buffers_to_write_.size() > 1 ? std::move(buffers_to_write_[1]) : nullptr);
+    }
+    {
+        std::lock_guard<std::mutex> lg(cv_m_);
+        // 容量不符合当前配置的next_buf_随buffers_to_write_释放, 前台需要时按新的容量分配
+        if(next_buf_ && next_buf_->Capactiy() != buffer_size_)
+        {
+            buffers_to_write_.push_back(std::move(next_buf_));
+        }
+        // 其余缓冲区放回缓冲池, 超出常驻数量的部分随buffers_to_write_释放
+        for(auto& buffer : buffers_to_write_)
+        {
+            if(buffer && buffer->Capactiy() == buffer_size_ && free_buffers_.size() + 4 < buffer_count_)
+            {
+                buffer->Clear();
+                free_buffers_.push_back(std::move(buffer));
+            }
+        }
+        // 缓冲区容量或常驻数量调小后, 池中多余的缓冲区也随buffers_to_write_释放
+        while(!free_buffers_.empty() && (free_buffers_.size() + 4 > buffer_count_ || free_buffers_.back()->Capactiy() != buffer_size_))
+        {
+            buffers_to_write_.push_back(std::move(free_buffers_.back()));
+            free_buffers_.pop_back();
+        }
+    }
+    buffers_to_write_.clear();
+    seqs_to_write_.clear();
+    // 每轮结束时写出挂起的重复计数, 但仍记住上一条日志, 跨轮的重复可以继续合并
+    if(collapser_)
+    {
+        collapser_->Finish(*output, false);
+    }
+    output->Flush();
+
+    // 持久化模式: 每轮写入后做一次fdatasync, 本轮之前到达的所有等待者共享这一次落盘
+    // settled_lsn_只由写出侧修改, 这里读取无需加锁
+    if(durable_ && (sync_lsn > settled_lsn_ || sync_batch > 0))
+    {
+        auto start = std::chrono::steady_clock::now();
+        const bool synced = output->Sync();
+        if(!synced)
+        {
+            std::fputs("AsyncLog: fdatasync failed\n", stderr);
+        }
+        auto cost = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start);
+        CompleteSync(written_lsn, sync_lsn, synced, sync_batch, cost);
+    }
+}
+
+AsyncLogImpl::BufferPtr AsyncLogImpl::NewBuffer(size_t capacity)
+{
+    return std::make_unique<Buffer>(capacity, &memory_used_);
+}
+
+AsyncLogImpl::BufferPtr AsyncLogImpl::Recycle(BufferPtr buffer)
+{
+    // buffer_size_只由后台线程修改, 这里读取无需加锁
+    if(buffer && buffer->Capactiy() == buffer_size_)
+    {
+        buffer->Clear();
+        return buffer;
     }
-    // 在DoBackgroundWork结束时, 冲洗掉前台线程缓存在的日志
+    return NewBuffer(buffer_size_);
+}
+
+void AsyncLogImpl::Retune(size_t round_bytes, size_t round_buffers)
+{
+    // 折算到一个flush间隔的写出量: 缓冲区写满时一轮可能远短于flush间隔
+    auto now = std::chrono::steady_clock::now();
+    auto elapsed = std::max<std::chrono::steady_clock::duration>(now - last_round_, std::chrono::milliseconds(1));
+    last_round_ = now;
+    const double rate = static_cast<double>(round_bytes) * flush_interval_.count()
+                        / std::chrono::duration<double, std::milli>(elapsed).count();
+    bytes_per_interval_ = bytes_per_interval_ == 0 ? rate : bytes_per_interval_ * 0.75 + rate * 0.25;
+    peak_buffers_ = std::max(static_cast<double>(round_buffers), peak_buffers_ * 0.9);
+
+    // 缓冲区容量: 取能容纳一个flush间隔写出量的2的幂, 超出一倍或不足四分之一时才调整, 避免来回抖动
+    const size_t min_size = std::min(ASYNC_LOG_MIN_TUNED_BUFFER_SIZE, max_buffer_size_);
+    const size_t max_size = std::max(min_size, std::min(max_buffer_size_, memory_limit_ / 4));
+    size_t want = min_size;
+    while(want < max_size && want < bytes_per_interval_)
+    {
+        want <<= 1;
+    }
+    want = std::min(want, max_size);
+    size_t size = buffer_size_;
+    if(want >= size * 2 || want * 4 <= size || size > max_size)
+    {
+        size = want;
+    }
+    // 常驻数量: 最近单轮的缓冲区数峰值再加上前台的两个; 高水位: 内存上限内能容纳的缓冲区数
+    const size_t limit = std::max<size_t>(memory_limit_ / size, 4);
+    const size_t count = std::min(std::max<size_t>(static_cast<size_t>(std::ceil(peak_buffers_)) + 2, 4), limit);
+    const size_t high_water = std::max<size_t>(limit, 2);
+    if(size != buffer_size_ || count != buffer_count_ || high_water != high_water_)
+    {
+        buffer_size_ = size;
+        buffer_count_ = count;
+        high_water_ = high_water;
+        ++retunes_;
+    }
+}
+
+void AsyncLogImpl::Drain()
+{
+    // 后台线程结束时, 冲洗掉前台线程缓存在的日志
+    std::lock_guard<std::mutex> lg(cv_m_);
+    auto output = LogFile::Create(dir_path_, false, file_options_);
+    convert_tsc_ = Logger::TscClockUsed() && TscClock::Invariant();
+    for(const auto& buffer : urgent_buffers_)
+    {
+        WriteBuffer(*output, buffer->ToStringView());
+    }
+    WriteBuffer(*output, cur_urgent_buf_->ToStringView());
+    urgent_buffers_.clear();
+    cur_urgent_buf_->Clear();
     for(const auto& buffer : buffers_)
     {
-        LogFile::Create(dir_path_,false)->Append(buffer->ToStringView());
+        WriteBuffer(*output, buffer->ToStringView());
+    }
+    WriteBuffer(*output, cur_buf_->ToStringView());
+    if(collapser_)
+    {
+        collapser_->Finish(*output, true);
+    }
+    // 最后一轮中因超出内存上限而丢弃的日志同样留下缺口标记, 它们之后的位置不算作落盘
+    uint64_t written_lsn = appended_lsn_;
+    if(over_limit_.records > 0)
+    {
+        char now[64];
+        detail::FormatNow(now, sizeof(now));
+        char drop_notice[256];
+        std::snprintf(drop_notice, sizeof(drop_notice), "Dropped %lu log records in %lu-%lu at %s, %zu bytes over the memory limit\n",
+            static_cast<unsigned long>(over_limit_.records),
+            static_cast<unsigned long>(over_limit_.first), static_cast<unsigned long>(over_limit_.last),
+            now, over_limit_.bytes);
+        std::fputs(drop_notice, stderr);
+        output->Append(drop_notice);
+        written_lsn = over_limit_.lsn;
+        over_limit_ = DropRange();
+    }
+    buffers_.clear();
+    buffer_seqs_.clear();
+    cur_buf_->Clear();
+    if(durable_)
+    {
+        const bool synced = output->Sync();
+        if(synced)
+        {
+            durable_lsn_ = written_lsn;
+        }
+        else
+        {
+            std::fputs("AsyncLog: fdatasync failed\n", stderr);
+            ++sync_stats_.failures;
+        }
+        const uint64_t lost = synced ? written_lsn : settled_lsn_;
+        if(durable_waiters_ > 0 && lost < appended_lsn_)
+        {
+            lost_lsns_.push_back(lost);
+        }
+        settled_lsn_ = appended_lsn_;
+    }
+    else
+    {
+        output->Flush();
     }
-    LogFile::Create(dir_path_,false)->Flush();
+    stopped_ = true;
+    durable_cv_.notify_all();
 }
\ No newline at end of file
@@ -0,0 +1,386 @@
+#include "include/AsyncLogWriter.h"
+#include "include/CurrentThread.h"
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <pthread.h>
+#include <sched.h>
+
+
+namespace doggy::detail
+{
+
+// 时间轮的槽数, 刻度为1ms时转一圈约4秒, 覆盖默认的flush间隔
+constexpr size_t WRITER_WHEEL_SLOTS = 4096;
+
+// 单层哈希时间轮: 截止时刻按刻度取整后落入对应的槽, 超过一圈的定时器在槽中等待后续轮次
+// 定时器不支持删除, 重新调度时旧的定时器以代数(generation)失效
+class TimerWheel
+{
+public:
+    struct Timer
+    {
+        uint64_t expire_tick;
+        WriterTask* task;
+        uint64_t generation;
+    };
+
+    TimerWheel(std::chrono::steady_clock::duration tick, std::chrono::steady_clock::time_point start)
+        : tick_(std::max(tick, std::chrono::steady_clock::duration(1))),
+          start_(start),
+          current_tick_(0),
+          timers_(0),
+          slots_(WRITER_WHEEL_SLOTS)
+    {
+
+    }
+
+    void Schedule(std::chrono::steady_clock::time_point deadline, WriterTask* task, uint64_t generation)
+    {
+        uint64_t tick = current_tick_ + 1;
+        if(deadline > start_)
+        {
+            // 向上取整, 定时器不会早于截止时刻触发
+            tick = std::max(tick, static_cast<uint64_t>((deadline - start_ + tick_ - std::chrono::steady_clock::duration(1)) / tick_));
+        }
+        slots_[tick % slots_.size()].push_back(Timer{tick, task, generation});
+        ++timers_;
+    }
+
+    // 推进到now, 对每个到期的定时器调用expire
+    template<typename Func>
+    void Advance(std::chrono::steady_clock::time_point now, Func&& expire)
+    {
+        if(now < start_)
+        {
+            return;
+        }
+        const uint64_t target = static_cast<uint64_t>((now - start_) / tick_);
+        // 落后超过一圈时每个槽只需要检查一次
+        uint64_t tick = std::max(current_tick_ + 1, target >= slots_.size() ? target - slots_.size() + 1 : 0);
+        for(; tick <= target && timers_ > 0; ++tick)
+        {
+            auto& slot = slots_[tick % slots_.size()];
+            for(size_t i = 0; i < slot.size();)
+            {
+                if(slot[i].expire_tick <= target)
+                {
+                    Timer timer = slot[i];
+                    slot[i] = slot.back();
+                    slot.pop_back();
+                    --timers_;
+                    expire(timer.task, timer.generation);
+                }
+                else
+                {
+                    ++i;
+                }
+            }
+        }
+        current_tick_ = std::max(current_tick_, target);
+    }
+
+    // 下一个非空槽对应的时刻, 其中的定时器可能属于之后的轮次, 届时再推进一次即可
+    std::chrono::steady_clock::time_point NextExpiry() const
+    {
+        if(timers_ == 0)
+        {
+            return std::chrono::steady_clock::time_point::max();
+        }
+        for(uint64_t tick = current_tick_ + 1; tick <= current_tick_ + slots_.size(); ++tick)
+        {
+            if(!slots_[tick % slots_.size()].empty())
+            {
+                return start_ + tick_ * tick;
+            }
+        }
+        return start_ + tick_ * (current_tick_ + slots_.size());
+    }
+
+private:
+    const std::chrono::steady_clock::duration tick_;
+    const std::chrono::steady_clock::time_point start_;
+    uint64_t current_tick_;
+    size_t timers_;
+    std::vector<std::vector<Timer>> slots_;
+};
+
+// 解析形如"0-3,8,10-11"的CPU列表
+std::vector<int> ParseCpuList(const std::string& list)
+{
+    std::vector<int> cpus;
+    size_t pos = 0;
+    while(pos < list.size())
+    {
+        size_t end = list.find(',', pos);
+        if(end == std::string::npos)
+        {
+            end = list.size();
+        }
+        std::string range = list.substr(pos, end - pos);
+        int first = 0;
+        int last = 0;
+        int n = std::sscanf(range.c_str(), "%d-%d", &first, &last);
+        if(n == 1)
+        {
+            last = first;
+        }
+        for(int cpu = first; n >= 1 && cpu <= last; ++cpu)
+        {
+            cpus.push_back(cpu);
+        }
+        pos = end + 1;
+    }
+    return cpus;
+}
+
+// 根据配置计算写线程允许运行的CPU, 返回false表示不绑定
+bool WriterCpus(const AsyncLogWriterOptions& options, cpu_set_t& set)
+{
+    if(options.cpus.empty() && options.numa_node < 0)
+    {
+        return false;
+    }
+    std::vector<int> cpus = options.cpus;
+    if(options.numa_node >= 0)
+    {
+        std::ifstream file("/sys/devices/system/node/node" + std::to_string(options.numa_node) + "/cpulist");
+        std::string list;
+        if(!std::getline(file, list))
+        {
+            std::fprintf(stderr, "AsyncLogWriter: NUMA node %d is not available\n", options.numa_node);
+            return false;
+        }
+        std::vector<int> node_cpus = ParseCpuList(list);
+        if(!cpus.empty())
+        {
+            std::vector<int> both;
+            for(int cpu : cpus)
+            {
+                if(std::find(node_cpus.begin(), node_cpus.end(), cpu) != node_cpus.end())
+                {
+                    both.push_back(cpu);
+                }
+            }
+            node_cpus.swap(both);
+        }
+        cpus.swap(node_cpus);
+    }
+    CPU_ZERO(&set);
+    for(int cpu : cpus)
+    {
+        if(cpu >= 0 && cpu < CPU_SETSIZE)
+        {
+            CPU_SET(cpu, &set);
+        }
+    }
+    if(CPU_COUNT(&set) == 0)
+    {
+        std::fputs("AsyncLogWriter: no CPU left to pin the writer threads to\n", stderr);
+        return false;
+    }
+    return true;
+}
+
+} // end namespace doggy::detail
+
+namespace doggy
+{
+
+class AsyncLogWriterImpl
+{
+public:
+    explicit AsyncLogWriterImpl(const AsyncLogWriterOptions& options)
+        : options_(options),
+          wheel_(options.tick, std::chrono::steady_clock::now())
+    {
+
+    }
+
+    // 写线程对每个任务的记录, 均由mutex_保护
+    struct TaskState
+    {
+        // 重新调度时递增, 时间轮中代数不同的定时器已经失效
+        uint64_t generation = 0;
+        // 某个写线程正在处理该任务
+        bool in_service = false;
+        // 处理期间又被唤醒, 处理完成后需要再检查一次
+        bool rerun = false;
+    };
+
+    const AsyncLogWriterOptions options_;
+    std::mutex mutex_;
+    // 写线程等待就绪任务或者时间轮到期
+    std::condition_variable cv_;
+    // Detach等待任务处理完成
+    std::condition_variable idle_cv_;
+    bool running_ = true;
+    std::unordered_map<detail::WriterTask*, TaskState> tasks_;
+    // 需要立即检查的任务, 可能包含重复或者已经摘除的任务, 取出时再过滤
+    std::deque<detail::WriterTask*> ready_;
+    detail::TimerWheel wheel_;
+    std::vector<std::thread> threads_;
+
+    // 在持有mutex_时调用
+    void Schedule(detail::WriterTask* task, TaskState& state, std::chrono::steady_clock::time_point deadline);
+    void Run(size_t index);
+};
+
+} // end namespace doggy
+
+using namespace doggy;
+
+
+std::shared_ptr<AsyncLogWriter> AsyncLogWriter::Create(const AsyncLogWriterOptions& options)
+{
+    return std::shared_ptr<AsyncLogWriter>(new AsyncLogWriter(options));
+}
+
+AsyncLogWriter::AsyncLogWriter(const AsyncLogWriterOptions& options)
+    : impl_(std::make_unique<AsyncLogWriterImpl>(options))
+{
+    const size_t threads = std::max<size_t>(options.threads, 1);
+    for(size_t i = 0; i < threads; ++i)
+    {
+        impl_->threads_.emplace_back(&AsyncLogWriterImpl::Run, impl_.get(), i);
+    }
+}
+
+AsyncLogWriter::~AsyncLogWriter()
+{
+    {
+        std::lock_guard<std::mutex> lg(impl_->mutex_);
+        impl_->running_ = false;
+    }
+    impl_->cv_.notify_all();
+    for(auto& thread : impl_->threads_)
+    {
+        thread.join();
+    }
+}
+
+size_t AsyncLogWriter::Instances() const
+{
+    std::lock_guard<std::mutex> lg(impl_->mutex_);
+    return impl_->tasks_.size();
+}
+
+void AsyncLogWriter::Attach(detail::WriterTask* task, std::chrono::steady_clock::time_point first_check)
+{
+    {
+        std::lock_guard<std::mutex> lg(impl_->mutex_);
+        impl_->Schedule(task, impl_->tasks_[task], first_check);
+    }
+    // 新的定时器可能早于写线程当前的睡眠截止时刻
+    impl_->cv_.notify_all();
+}
+
+void AsyncLogWriter::Detach(detail::WriterTask* task)
+{
+    std::unique_lock<std::mutex> lk(impl_->mutex_);
+    impl_->idle_cv_.wait(lk, [&]
+    {
+        auto it = impl_->tasks_.find(task);
+        return it == impl_->tasks_.end() || !it->second.in_service;
+    });
+    impl_->tasks_.erase(task);
+}
+
+void AsyncLogWriter::Wake(detail::WriterTask* task)
+{
+    {
+        std::lock_guard<std::mutex> lg(impl_->mutex_);
+        impl_->ready_.push_back(task);
+    }
+    impl_->cv_.notify_one();
+}
+
+void AsyncLogWriterImpl::Schedule(detail::WriterTask* task, TaskState& state, std::chrono::steady_clock::time_point deadline)
+{
+    ++state.generation;
+    if(deadline <= std::chrono::steady_clock::now())
+    {
+        ready_.push_back(task);
+    }
+    else if(deadline != std::chrono::steady_clock::time_point::max())
+    {
+        wheel_.Schedule(deadline, task, state.generation);
+    }
+}
+
+void AsyncLogWriterImpl::Run(size_t index)
+{
+    // 设置写线程名字, 方便分线程观测程序的运行情况
+    CurrentThread::SetName("LogWriter-" + std::to_string(index));
+
+    cpu_set_t cpus;
+    if(detail::WriterCpus(options_, cpus) && ::pthread_setaffinity_np(::pthread_self(), sizeof(cpus), &cpus) != 0)
+    {
+        std::fputs("AsyncLogWriter: cannot set the CPU affinity of the writer thread\n", stderr);
+    }
+
+    std::unique_lock<std::mutex> lk(mutex_);
+    while(running_)
+    {
+        wheel_.Advance(std::chrono::steady_clock::now(), [this](detail::WriterTask* task, uint64_t generation)
+        {
+            auto it = tasks_.find(task);
+            if(it != tasks_.end() && it->second.generation == generation)
+            {
+                ready_.push_back(task);
+            }
+        });
+        if(ready_.empty())
+        {
+            auto expiry = wheel_.NextExpiry();
+            if(expiry == std::chrono::steady_clock::time_point::max())
+            {
+                cv_.wait(lk);
+            }
+            else
+            {
+                cv_.wait_until(lk, expiry);
+            }
+            continue;
+        }
+
+        auto task = ready_.front();
+        ready_.pop_front();
+        auto it = tasks_.find(task);
+        if(it == tasks_.end())
+        {
+            continue;
+        }
+        // 任务处理期间不会被摘除, 而unordered_map的rehash不会使元素的引用失效
+        TaskState& state = it->second;
+        if(state.in_service)
+        {
+            state.rerun = true;
+            continue;
+        }
+        state.in_service = true;
+        // 令时间轮中该任务的定时器失效, 处理完成后按新的截止时刻重新调度
+        ++state.generation;
+
+        lk.unlock();
+        auto next = task->Service();
+        lk.lock();
+
+        state.in_service = false;
+        if(state.rerun)
+        {
+            state.rerun = false;
+            next = std::chrono::steady_clock::time_point::min();
+        }
+        Schedule(task, state, next);
+        idle_cv_.notify_all();
+    }
+}
@@ -0,0 +1,100 @@
+#include "include/CurrentThread.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <pthread.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+
+namespace doggy::detail
+{
+// 线程名的最大长度, 包括结尾的'\0'
+constexpr size_t KMAX_THREAD_NAME_SIZE = 16;
+
+struct ThreadIdentity
+{
+    // tid为0表示缓存失效, 需要重新获取
+    pid_t tid = 0;
+    char name[KMAX_THREAD_NAME_SIZE] = {};
+    size_t name_len = 0;
+    // "tid name "
+    char header[32 + KMAX_THREAD_NAME_SIZE] = {};
+    size_t header_len = 0;
+};
+
+thread_local ThreadIdentity t_identity;
+
+void FormatHeader(ThreadIdentity& id)
+{
+    // 线程名中的空白会破坏日志头部的字段划分, 统一替换为'_'
+    std::replace_if(id.name, id.name + id.name_len, [](char c){ return c == ' ' || c == '\t' || c == '\n'; }, '_');
+    int len = std::snprintf(id.header, sizeof(id.header), "%d %.*s ", id.tid, static_cast<int>(id.name_len), id.name);
+    id.header_len = std::min(static_cast<size_t>(len), sizeof(id.header) - 1);
+}
+
+void RefreshIdentity(ThreadIdentity& id)
+{
+    id.tid = static_cast<pid_t>(::syscall(SYS_gettid));
+    if(::pthread_getname_np(::pthread_self(), id.name, sizeof(id.name)) != 0)
+    {
+        id.name[0] = '\0';
+    }
+    id.name_len = std::strlen(id.name);
+    FormatHeader(id);
+}
+
+inline ThreadIdentity& Identity()
+{
+    if(__builtin_expect(t_identity.tid == 0, 0))
+    {
+        RefreshIdentity(t_identity);
+    }
+    return t_identity;
+}
+
+// fork之后子进程中只剩下调用fork的线程, 它的tid已经改变, 令其缓存失效即可
+void AfterForkInChild()
+{
+    t_identity.tid = 0;
+}
+
+const int register_atfork = ::pthread_atfork(nullptr, nullptr, &AfterForkInChild);
+
+} // end namespace doggy::detail
+
+using namespace doggy;
+using namespace doggy::detail;
+
+pid_t CurrentThread::Tid()
+{
+    return Identity().tid;
+}
+
+std::string_view CurrentThread::Name()
+{
+    auto& id = Identity();
+    return std::string_view(id.name, id.name_len);
+}
+
+std::string_view CurrentThread::Header()
+{
+    auto& id = Identity();
+    return std::string_view(id.header, id.header_len);
+}
+
+void CurrentThread::SetName(std::string_view name)
+{
+    auto& id = Identity();
+    id.name_len = std::min(name.size(), KMAX_THREAD_NAME_SIZE - 1);
+    std::memcpy(id.name, name.data(), id.name_len);
+    id.name[id.name_len] = '\0';
+    ::pthread_setname_np(::pthread_self(), id.name);
+    FormatHeader(id);
+}
+
+void CurrentThread::Refresh()
+{
+    RefreshIdentity(t_identity);
+}
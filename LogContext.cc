@@ -0,0 +1,76 @@
+#include "include/LogContext.h"
+
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+
+namespace doggy::detail
+{
+
+struct ContextStack
+{
+    std::vector<std::pair<std::string, std::string>> entries;
+    // 缓存的渲染结果, dirty为true时需要重新渲染
+    std::string prefix;
+    bool dirty = false;
+};
+
+thread_local ContextStack t_context;
+
+void RenderPrefix(ContextStack& ctx)
+{
+    ctx.prefix.clear();
+    if(!ctx.entries.empty())
+    {
+        ctx.prefix.push_back('{');
+        for(size_t i = 0; i < ctx.entries.size(); ++i)
+        {
+            if(i != 0)
+            {
+                ctx.prefix.push_back(' ');
+            }
+            ctx.prefix.append(ctx.entries[i].first);
+            ctx.prefix.push_back('=');
+            ctx.prefix.append(ctx.entries[i].second);
+        }
+        ctx.prefix.append("} ");
+    }
+    ctx.dirty = false;
+}
+
+} // end namespace doggy::detail
+
+using namespace doggy;
+using namespace doggy::detail;
+
+void LogContext::Push(std::string_view key, std::string_view value)
+{
+    t_context.entries.emplace_back(key, value);
+    t_context.dirty = true;
+}
+
+void LogContext::Pop()
+{
+    if(!t_context.entries.empty())
+    {
+        t_context.entries.pop_back();
+        t_context.dirty = true;
+    }
+}
+
+void LogContext::Clear()
+{
+    t_context.entries.clear();
+    t_context.dirty = true;
+}
+
+std::string_view LogContext::Prefix()
+{
+    if(t_context.dirty)
+    {
+        RenderPrefix(t_context);
+    }
+    return t_context.prefix;
+}
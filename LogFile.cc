@@ -6,8 +6,15 @@
 #include <memory>
 #include <mutex>
 #include <string>
-#include <fstream>
 #include <string_view>
+#include <unordered_map>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 
 namespace doggy::detail 
@@ -16,21 +23,61 @@ namespace doggy::detail
     {
         auto now = std::chrono::system_clock::now();
         auto now_t = std::chrono::system_clock::to_time_t(now);
-        auto now_tm = *std::localtime(&now_t);
+        // 多个写线程可能同时切分文件, 使用可重入的localtime_r
+        std::tm now_tm;
+        ::localtime_r(&now_t, &now_tm);
 
         char buffer[32];
         std::strftime(buffer, sizeof(buffer), "%Y%m%d%H", &now_tm);
         return std::string(buffer);
     }
+
+    // 普通写入模式下暂存区的大小
+    constexpr size_t LOGFILE_STAGING_SIZE = 64 * 1024;
+    // 直接I/O模式下暂存区的大小, 与AsyncLog默认的缓冲区大小一致, 并且是块大小的整数倍
+    constexpr size_t LOGFILE_DIRECT_STAGING_SIZE = 4000 * 1024;
+    // 直接I/O要求的对齐粒度
+    constexpr size_t LOGFILE_DIRECT_ALIGN = 4096;
+
+    // 写出全部数据, offset为-1时使用write, 否则使用pwrite
+    bool WriteAll(int fd, const char* data, size_t size, off_t offset = -1)
+    {
+        while(size > 0)
+        {
+            ssize_t n = offset < 0 ? ::write(fd, data, size) : ::pwrite(fd, data, size, offset);
+            if(n < 0)
+            {
+                if(errno == EINTR)
+                {
+                    continue;
+                }
+                return false;
+            }
+            data += n;
+            size -= n;
+            if(offset >= 0)
+            {
+                offset += n;
+            }
+        }
+        return true;
+    }
 }
 
 
-namespace doggy 
+namespace doggy::detail
 {
-    std::shared_ptr<LogFile> LogFile::current_file_ = nullptr;
-    std::string LogFile::current_file_name_{};
-    size_t LogFile::current_suffix_ = 0;
-    size_t LogFile::current_file_size_ = 0;
+    // 一个日志目录的文件切分状态
+    struct LogFileRotation
+    {
+        std::string file_name;
+        size_t suffix = 0;
+        std::shared_ptr<LogFile> file;
+    };
+
+    std::mutex rotation_mutex;
+    // 以规范化后的目录路径为键, 多个AsyncLog实例写不同目录时互不影响
+    std::unordered_map<std::string, LogFileRotation> rotations;
 }
 
 using namespace doggy;
@@ -39,47 +86,124 @@ using namespace std;
 
 
 
-shared_ptr<LogFile> LogFile::Create(const std::filesystem::path& dir_path, bool threadsafe)
+shared_ptr<LogFile> LogFile::Create(const std::filesystem::path& dir_path, bool threadsafe, const LogFileOptions& options)
 {
     string now_h = detail::GetCurrentHourTimestamp();
+    std::lock_guard<std::mutex> lg(detail::rotation_mutex);
+    auto& rotation = detail::rotations[dir_path.lexically_normal().string()];
     // 如果当前小时还没有创建过日志文件, 则以当前时刻为文件名创建日志文件
-    if(current_file_name_.empty() || string_view(current_file_name_).substr(0,13) != now_h)
+    if(rotation.file_name.empty() || string_view(rotation.file_name).substr(0,13) != now_h)
     {
-        current_file_name_ = now_h;
-        current_suffix_ = 0;
-        current_file_size_ = 0;
+        rotation.file_name = now_h;
+        rotation.suffix = 0;
         
-        auto file_path = dir_path / (current_file_name_ + "-" + to_string(current_suffix_) + ".log");
-        current_file_ = make_shared<LogFile>(file_path, threadsafe);
+        auto file_path = dir_path / (rotation.file_name + "-" + to_string(rotation.suffix) + ".log");
+        rotation.file = make_shared<LogFile>(file_path, threadsafe, options);
     }
     // 如果当前文件已经达到最大容量, 则为当前小时再创建一个日志文件, 并以递增的后缀区分
-    else if(current_file_size_ > MAX_LOGFILE_SIZE)
+    else if(rotation.file->appended_size_ > MAX_LOGFILE_SIZE)
     {
-        ++current_suffix_;
-        auto file_path = dir_path / (current_file_name_ + "-" + to_string(current_suffix_) + ".log");
-        current_file_size_ = 0;
-        current_file_ = make_shared<LogFile>(file_path, threadsafe);
+        ++rotation.suffix;
+        auto file_path = dir_path / (rotation.file_name + "-" + to_string(rotation.suffix) + ".log");
+        rotation.file = make_shared<LogFile>(file_path, threadsafe, options);
     }
-    return current_file_;
+    return rotation.file;
 }
 
 
-LogFile::LogFile(const std::filesystem::path& file_path, bool threadsafe)
+LogFile::LogFile(const std::filesystem::path& file_path, bool threadsafe, const LogFileOptions& options)
     : file_path_(file_path),
-      thread_safe_(threadsafe)
+      thread_safe_(threadsafe),
+      options_(options),
+      fd_(-1),
+      tail_fd_(-1),
+      staging_(nullptr, &std::free),
+      staging_capacity_(options.direct_io ? detail::LOGFILE_DIRECT_STAGING_SIZE : detail::LOGFILE_STAGING_SIZE),
+      staging_size_(0),
+      staged_offset_(0),
+      file_size_(0),
+      writeback_offset_(0),
+      dropped_offset_(0),
+      preallocated_(false),
+      dir_synced_(true),
+      write_failed_(false),
+      appended_size_(0)
 {
 
     if(auto dir_path = file_path.parent_path(); !std::filesystem::exists(file_path.parent_path()))
     {   
         std::filesystem::create_directories(dir_path);
     }
-    out_.open(file_path,std::fstream::out | std::fstream::app);
+    staging_.reset(static_cast<char*>(std::aligned_alloc(detail::LOGFILE_DIRECT_ALIGN, staging_capacity_)));
+    dir_synced_ = std::filesystem::exists(file_path);
+
+    if(options_.direct_io)
+    {
+        fd_ = ::open(file_path.c_str(), O_WRONLY | O_CREAT | O_DIRECT | O_CLOEXEC, 0644);
+        if(fd_ < 0 && errno == EINVAL)
+        {
+            // 文件系统不支持O_DIRECT(例如tmpfs), 仍按块写入, 只是经过page cache
+            std::fprintf(stderr, "LogFile: O_DIRECT is not supported for %s, using buffered writes\n", file_path.c_str());
+            fd_ = ::open(file_path.c_str(), O_WRONLY | O_CREAT | O_CLOEXEC, 0644);
+        }
+        tail_fd_ = ::open(file_path.c_str(), O_RDWR | O_CLOEXEC);
+        // 文件已存在时从最后一个块的起点继续写, 先把该块中已有的内容读入暂存区
+        struct stat st{};
+        if(tail_fd_ >= 0 && ::fstat(tail_fd_, &st) == 0)
+        {
+            file_size_ = st.st_size;
+            staged_offset_ = file_size_ / detail::LOGFILE_DIRECT_ALIGN * detail::LOGFILE_DIRECT_ALIGN;
+            staging_size_ = file_size_ - staged_offset_;
+            if(staging_size_ > 0 && ::pread(tail_fd_, staging_.get(), staging_size_, staged_offset_) != static_cast<ssize_t>(staging_size_))
+            {
+                std::memset(staging_.get(), 0, staging_size_);
+            }
+        }
+    }
+    else
+    {
+        fd_ = ::open(file_path.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+        struct stat st{};
+        if(fd_ >= 0 && ::fstat(fd_, &st) == 0)
+        {
+            file_size_ = st.st_size;
+        }
+    }
+    if(fd_ < 0)
+    {
+        std::fprintf(stderr, "LogFile: cannot open %s: %s\n", file_path.c_str(), std::strerror(errno));
+        return;
+    }
+    writeback_offset_ = dropped_offset_ = file_size_;
+
+    // 预分配整个分段, 避免每次文件增长都更新元数据; FALLOC_FL_KEEP_SIZE保证文件大小不变
+    if(options_.preallocate && file_size_ < static_cast<size_t>(MAX_LOGFILE_SIZE))
+    {
+        preallocated_ = ::fallocate(fd_, FALLOC_FL_KEEP_SIZE, 0, MAX_LOGFILE_SIZE) == 0;
+    }
 }
 
 LogFile::~LogFile()
 {
-    out_.flush();
-    out_.close();
+    flush();
+    if(fd_ >= 0)
+    {
+        // 释放文件末尾之后未用到的预分配空间. 对超出文件大小的区域打洞在ext4上不生效,
+        // 按当前大小ftruncate才会回收这部分块
+        struct stat st{};
+        if(preallocated_ && ::fstat(fd_, &st) == 0 && st.st_size < MAX_LOGFILE_SIZE)
+        {
+            if(::ftruncate(fd_, st.st_size) != 0)
+            {
+                ::fallocate(fd_, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, st.st_size, MAX_LOGFILE_SIZE - st.st_size);
+            }
+        }
+        ::close(fd_);
+    }
+    if(tail_fd_ >= 0)
+    {
+        ::close(tail_fd_);
+    }
 }
 
 void LogFile::Append(std::string_view logs)
@@ -97,11 +221,189 @@ void LogFile::Append(std::string_view logs)
 
 void LogFile::Flush()
 {
-    out_.flush();
+    if(thread_safe_)
+    {
+        std::lock_guard<std::mutex> lg(file_mutex_);
+        flush();
+    }
+    else
+    {
+        flush();
+    }
+}
+
+bool LogFile::Sync()
+{
+    std::unique_lock<std::mutex> lk(file_mutex_, std::defer_lock);
+    if(thread_safe_)
+    {
+        lk.lock();
+    }
+    flush();
+    if(fd_ < 0 || write_failed_ || ::fdatasync(fd_) != 0)
+    {
+        return false;
+    }
+    if(!dir_synced_)
+    {
+        // 新文件的目录项只有在目录fsync之后才能保证落盘
+        auto dir_path = file_path_.parent_path().empty() ? std::filesystem::path(".") : file_path_.parent_path();
+        int dir_fd = ::open(dir_path.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        dir_synced_ = dir_fd >= 0 && ::fsync(dir_fd) == 0;
+        if(dir_fd >= 0)
+        {
+            ::close(dir_fd);
+        }
+    }
+    return dir_synced_;
 }
 
 void LogFile::append(std::string_view logs)
 {
-    current_file_size_ += logs.size();
-    out_ << logs;
+    appended_size_ += logs.size();
+    if(fd_ < 0)
+    {
+        return;
+    }
+    if(!options_.direct_io)
+    {
+        // 普通写入: 小块日志先攒在暂存区, 大块日志直接写入, 不再拷贝
+        if(staging_size_ + logs.size() > staging_capacity_)
+        {
+            writeStaging(false);
+        }
+        if(logs.size() >= staging_capacity_)
+        {
+            if(detail::WriteAll(fd_, logs.data(), logs.size()))
+            {
+                file_size_ += logs.size();
+            }
+            else
+            {
+                writeFailed();
+            }
+            return;
+        }
+        std::memcpy(staging_.get() + staging_size_, logs.data(), logs.size());
+        staging_size_ += logs.size();
+        return;
+    }
+    // 直接I/O: 所有日志都要先拷贝到对齐的暂存区
+    while(!logs.empty())
+    {
+        size_t n = std::min(logs.size(), staging_capacity_ - staging_size_);
+        std::memcpy(staging_.get() + staging_size_, logs.data(), n);
+        staging_size_ += n;
+        logs.remove_prefix(n);
+        if(staging_size_ == staging_capacity_)
+        {
+            writeStaging(true);
+        }
+    }
+}
+
+void LogFile::flush()
+{
+    if(fd_ < 0)
+    {
+        return;
+    }
+    if(!options_.direct_io)
+    {
+        writeStaging(false);
+        if(options_.drop_cache)
+        {
+            dropWrittenPages();
+        }
+        return;
+    }
+    writeStaging(true);
+    // 不足一块的尾部经普通fd写入, 文件大小保持准确; 之后该块写满时再由O_DIRECT覆盖
+    if(staging_size_ > 0)
+    {
+        if(detail::WriteAll(tail_fd_, staging_.get(), staging_size_, staged_offset_))
+        {
+            file_size_ = std::max(file_size_, staged_offset_ + staging_size_);
+        }
+        else
+        {
+            writeFailed();
+        }
+    }
+}
+
+bool LogFile::writeStaging(bool whole_blocks_only)
+{
+    if(!options_.direct_io)
+    {
+        bool ok = detail::WriteAll(fd_, staging_.get(), staging_size_);
+        if(ok)
+        {
+            file_size_ += staging_size_;
+        }
+        else
+        {
+            writeFailed();
+        }
+        staging_size_ = 0;
+        return ok;
+    }
+    size_t whole = whole_blocks_only ? staging_size_ / detail::LOGFILE_DIRECT_ALIGN * detail::LOGFILE_DIRECT_ALIGN : staging_size_;
+    if(whole == 0)
+    {
+        return true;
+    }
+    bool ok = detail::WriteAll(fd_, staging_.get(), whole, staged_offset_);
+    if(!ok && errno == EINVAL)
+    {
+        disableDirectIo();
+        ok = detail::WriteAll(fd_, staging_.get(), whole, staged_offset_);
+    }
+    if(ok)
+    {
+        file_size_ = std::max(file_size_, staged_offset_ + whole);
+    }
+    else
+    {
+        // 暂存区仍然前移, 这部分日志已经丢失
+        writeFailed();
+    }
+    staged_offset_ += whole;
+    staging_size_ -= whole;
+    std::memmove(staging_.get(), staging_.get() + whole, staging_size_);
+    return ok;
+}
+
+void LogFile::disableDirectIo()
+{
+    std::fprintf(stderr, "LogFile: O_DIRECT write failed for %s, using buffered writes\n", file_path_.c_str());
+    int flags = ::fcntl(fd_, F_GETFL);
+    ::fcntl(fd_, F_SETFL, flags & ~O_DIRECT);
+}
+
+void LogFile::writeFailed()
+{
+    if(!write_failed_)
+    {
+        std::fprintf(stderr, "LogFile: cannot write %s: %s\n", file_path_.c_str(), std::strerror(errno));
+        write_failed_ = true;
+    }
+}
+
+void LogFile::dropWrittenPages()
+{
+    if(file_size_ > writeback_offset_)
+    {
+        // 等待上一次启动的回写完成, 干净的页才能被移出page cache
+        if(writeback_offset_ > dropped_offset_)
+        {
+            ::sync_file_range(fd_, dropped_offset_, writeback_offset_ - dropped_offset_,
+                SYNC_FILE_RANGE_WAIT_BEFORE | SYNC_FILE_RANGE_WRITE | SYNC_FILE_RANGE_WAIT_AFTER);
+            ::posix_fadvise(fd_, dropped_offset_, writeback_offset_ - dropped_offset_, POSIX_FADV_DONTNEED);
+            dropped_offset_ = writeback_offset_;
+        }
+        // 异步启动本次新写入部分的回写
+        ::sync_file_range(fd_, writeback_offset_, file_size_ - writeback_offset_, SYNC_FILE_RANGE_WRITE);
+        writeback_offset_ = file_size_;
+    }
 }
\ No newline at end of file
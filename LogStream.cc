@@ -61,18 +61,23 @@ size_t Convert2Hex(uintptr_t value, char *buffer)
 using namespace doggy;
 using namespace doggy::detail;
 
-LogStream::LogStream() : buffer_(std::make_unique<LogStream::Buffer>())
+template<int SIZE>
+BasicLogStream<SIZE>::BasicLogStream() : buffer_(std::make_unique<Buffer>())
 {
 
 }
 
-LogStream::LogStream(LogStream&&) = default;
-LogStream& LogStream::operator=(LogStream&&) = default;
+template<int SIZE>
+BasicLogStream<SIZE>::BasicLogStream(BasicLogStream&&) = default;
+template<int SIZE>
+BasicLogStream<SIZE>& BasicLogStream<SIZE>::operator=(BasicLogStream&&) = default;
 
-LogStream::~LogStream() = default;
+template<int SIZE>
+BasicLogStream<SIZE>::~BasicLogStream() = default;
 
+template<int SIZE>
 template<typename T>
-void LogStream::formatInteger(T value)
+void BasicLogStream<SIZE>::formatInteger(T value)
 {
     if(buffer_->Avail() >= KMAX_NUMERIC_SIZE)
     {
@@ -82,74 +87,86 @@ void LogStream::formatInteger(T value)
     }
 }
 
-LogStream& LogStream::operator<<(bool b)
+template<int SIZE>
+BasicLogStream<SIZE>& BasicLogStream<SIZE>::operator<<(bool b)
 {
     // 将bool值转换成字符串加入缓存区
     buffer_->Append(b ? "1" : "0");
     return *this;
 }
 
-LogStream& LogStream::operator<<(char c)
+template<int SIZE>
+BasicLogStream<SIZE>& BasicLogStream<SIZE>::operator<<(char c)
 {
-    buffer_->Append(&c);
+    buffer_->Append(std::string_view(&c, 1));
     return *this;
 }
 
-LogStream& LogStream::operator<<(short s)
+template<int SIZE>
+BasicLogStream<SIZE>& BasicLogStream<SIZE>::operator<<(short s)
 {
     *this << static_cast<int>(s);
     return *this;
 }
 
-LogStream& LogStream::operator<<(unsigned short us)
+template<int SIZE>
+BasicLogStream<SIZE>& BasicLogStream<SIZE>::operator<<(unsigned short us)
 {
     *this << static_cast<unsigned>(us);
     return *this;
 }
 
-LogStream& LogStream::operator<<(int i)
+template<int SIZE>
+BasicLogStream<SIZE>& BasicLogStream<SIZE>::operator<<(int i)
 {
     formatInteger(i);
     return *this;
 }
 
-LogStream& LogStream::operator<<(unsigned int ui)
+template<int SIZE>
+BasicLogStream<SIZE>& BasicLogStream<SIZE>::operator<<(unsigned int ui)
 {
     formatInteger(ui);
     return *this;
 }
 
-LogStream& LogStream::operator<<(long l)
+template<int SIZE>
+BasicLogStream<SIZE>& BasicLogStream<SIZE>::operator<<(long l)
 {
     formatInteger(l);
     return *this;
 }
 
-LogStream& LogStream::operator<<(unsigned long ul)
+template<int SIZE>
+BasicLogStream<SIZE>& BasicLogStream<SIZE>::operator<<(unsigned long ul)
 {
     formatInteger(ul);
     return *this;
 }
 
-LogStream& LogStream::operator<<(long long ll)
+template<int SIZE>
+BasicLogStream<SIZE>& BasicLogStream<SIZE>::operator<<(long long ll)
 {
     formatInteger(ll);
     return *this;
 }
 
-LogStream& LogStream::operator<<(unsigned long long ull)
+template<int SIZE>
+BasicLogStream<SIZE>& BasicLogStream<SIZE>::operator<<(unsigned long long ull)
 {
     formatInteger(ull);
     return *this;
 }
 
-LogStream& LogStream::operator<<(float f)
+template<int SIZE>
+BasicLogStream<SIZE>& BasicLogStream<SIZE>::operator<<(float f)
 {
     *this << static_cast<double>(f);
     return *this;
 }
 
-LogStream& LogStream::operator<<(double d)
+template<int SIZE>
+BasicLogStream<SIZE>& BasicLogStream<SIZE>::operator<<(double d)
 {
     if(buffer_->Avail() >= KMAX_NUMERIC_SIZE)
     {
@@ -160,7 +177,8 @@ LogStream& LogStream::operator<<(double d)
     return *this;
 }
 
-LogStream& LogStream::operator<<(const void* p)
+template<int SIZE>
+BasicLogStream<SIZE>& BasicLogStream<SIZE>::operator<<(const void* p)
 {
     std::uintptr_t v = reinterpret_cast<std::uintptr_t>(p);
     constexpr size_t KMAX_NUMERIC_SIZE_Plus_2 = KMAX_NUMERIC_SIZE + 2;
@@ -175,7 +193,8 @@ LogStream& LogStream::operator<<(const void* p)
     return *this;
 }
 
-LogStream& LogStream::operator<<(const char* str)
+template<int SIZE>
+BasicLogStream<SIZE>& BasicLogStream<SIZE>::operator<<(const char* str)
 {
     if(str)
     {
@@ -188,23 +207,33 @@ LogStream& LogStream::operator<<(const char* str)
     return *this;
 }
 
-LogStream& LogStream::operator<<(const unsigned char* str)
+template<int SIZE>
+BasicLogStream<SIZE>& BasicLogStream<SIZE>::operator<<(const unsigned char* str)
 {
     return *this<<reinterpret_cast<const char*>(str);
 }
 
-LogStream& LogStream::operator<<(std::string_view sv)
+template<int SIZE>
+BasicLogStream<SIZE>& BasicLogStream<SIZE>::operator<<(std::string_view sv)
 {
     buffer_->Append(sv);
     return *this;
 }
 
-LogStream& LogStream::operator<<(const FixedBuffer<DEFAULT_LOGSTREAM_BUFFER_SIZE>& buffer)
+template<int SIZE>
+BasicLogStream<SIZE>& BasicLogStream<SIZE>::operator<<(const FixedBuffer<SIZE>& buffer)
 {
     return *this<<buffer.ToStringView();
 }
 
-std::string_view LogStream::ToStringView() const
+template<int SIZE>
+std::string_view BasicLogStream<SIZE>::ToStringView() const
 {
     return buffer_->ToStringView();
-}
\ No newline at end of file
+}
+
+// 显式实例化, 与IsSupportedLogStreamSize保持一致
+template class doggy::BasicLogStream<256>;
+template class doggy::BasicLogStream<1024>;
+template class doggy::BasicLogStream<4096>;
+template class doggy::BasicLogStream<16384>;
\ No newline at end of file
@@ -1,10 +1,14 @@
 #include "include/Logger.h"
 #include "include/LogStream.h"
+#include "include/CurrentThread.h"
+#include "include/LogContext.h"
+#include "include/TscClock.h"
 
 #include <cstdio>
 #include <iostream>
 #include <memory>
 #include <chrono>
+#include <ctime>
 
 
 namespace doggy 
@@ -44,8 +48,23 @@ void DefaultFlush()
 
 // 设置默认的日志输出函数
 Logger::OutputFunc Logger::output_func_= DefaultOutput;
+Logger::LevelOutputFunc Logger::level_output_func_ = nullptr;
 Logger::FlushFunc Logger::flush_func_ = DefaultFlush;
 LogLevel Logger::output_level_ = LogLevel::TRACE;
+std::atomic<LogClock> Logger::clock_{LogClock::SYSTEM};
+std::atomic<bool> Logger::tsc_used_{false};
+
+namespace detail
+{
+// 同一秒内的日志复用已经格式化好的"YYYY-MM-DD HH:MM:SS", 避免每条日志都调用localtime
+struct SecondCache
+{
+    time_t second = -1;
+    char text[20];
+};
+
+thread_local SecondCache t_second_cache;
+}
 
 } // end namespace doggy
 
@@ -79,7 +98,14 @@ Logger& Logger::operator=(Logger&&) = default;
 Logger::~Logger()
 {
     impl_->Finish();
-    output_func_(impl_->stream_.ToStringView());
+    if(level_output_func_)
+    {
+        level_output_func_(impl_->stream_.ToStringView(), impl_->level_);
+    }
+    else
+    {
+        output_func_(impl_->stream_.ToStringView());
+    }
     if(impl_->level_ == LogLevel::FATAL)
     {
         flush_func_();
@@ -97,11 +123,35 @@ void Logger::SetOutput(const OutputFunc& func)
     output_func_ = func;
 }
 
+void Logger::SetLevelOutput(const LevelOutputFunc& func)
+{
+    level_output_func_ = func;
+}
+
 void Logger::SetFlush(const FlushFunc& func)
 {
     flush_func_ = func;
 }
 
+void Logger::SetClock(LogClock clock)
+{
+    if(clock == LogClock::TSC)
+    {
+        tsc_used_.store(true, std::memory_order_relaxed);
+    }
+    clock_.store(clock, std::memory_order_release);
+}
+
+LogClock Logger::GetClock()
+{
+    return clock_.load(std::memory_order_relaxed);
+}
+
+bool Logger::TscClockUsed()
+{
+    return tsc_used_.load(std::memory_order_relaxed);
+}
+
 void Logger::SetOutputLogLevel(LogLevel level)
 {
     output_level_ = level;
@@ -120,18 +170,54 @@ LoggerImpl::LoggerImpl(LogLevel level, SourceFile file, long line)
         line_(line),
         stream_(LogStream()) 
 {
-    stream_ << "[" << LogLevelString[int(level_)] << "]";
+    detail::FormatHeader(stream_, level_, basename_, line_);
+}
+
+template <int SIZE>
+void detail::FormatHeader(BasicLogStream<SIZE>& stream, LogLevel level, SourceFile file, int line)
+{
+    stream << "[" << LogLevelString[int(level)] << "]";
 
-    auto now = std::chrono::system_clock::now();
-    auto tt = std::chrono::system_clock::to_time_t(std::move(now));
-    auto tm = std::localtime(&tt);
-    char time[128];
-    sprintf(time, "%d-%02d-%02d %02d:%02d:%02d", tm->tm_year+1900,tm->tm_mon+1,tm->tm_mday,tm->tm_hour,tm->tm_min,tm->tm_sec);
-    stream_<<time;
+    // acquire: 后台线程换算这条日志时一定能看到SetClock设置的tsc_used_
+    if(Logger::clock_.load(std::memory_order_acquire) == LogClock::TSC)
+    {
+        char time[32];
+        if(TscClock::Invariant())
+        {
+            FormatTscPlaceholder(TscClock::Now(), time);
+            stream << std::string_view(time, TSC_PLACEHOLDER_SIZE);
+        }
+        else
+        {
+            timespec ts;
+            clock_gettime(CLOCK_REALTIME, &ts);
+            stream << std::string_view(time, FormatWallTime(static_cast<int64_t>(ts.tv_sec) * 1000000000 + ts.tv_nsec, time));
+        }
+    }
+    else
+    {
+        auto now = std::chrono::system_clock::now();
+        auto tt = std::chrono::system_clock::to_time_t(std::move(now));
+        auto& cache = t_second_cache;
+        if(cache.second != tt)
+        {
+            std::tm tm;
+            localtime_r(&tt, &tm);
+            std::strftime(cache.text, sizeof(cache.text), "%Y-%m-%d %H:%M:%S", &tm);
+            cache.second = tt;
+        }
+        stream << std::string_view(cache.text, 19);
+    }
 
-    stream_ << " "<<file.ToStringView()<<":" << line_ << " ";
+    stream << " " << CurrentThread::Header() << LogContext::Prefix() << file.ToStringView()<<":" << line << " ";
 }
 
+// 显式实例化, 与IsSupportedLogStreamSize保持一致
+template void detail::FormatHeader(BasicLogStream<256>&, LogLevel, SourceFile, int);
+template void detail::FormatHeader(BasicLogStream<1024>&, LogLevel, SourceFile, int);
+template void detail::FormatHeader(BasicLogStream<4096>&, LogLevel, SourceFile, int);
+template void detail::FormatHeader(BasicLogStream<16384>&, LogLevel, SourceFile, int);
+
 void LoggerImpl::Finish()
 {
     stream_ << "\n";
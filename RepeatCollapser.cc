@@ -0,0 +1,152 @@
+#include "include/RepeatCollapser.h"
+#include "include/LogFile.h"
+
+#include <charconv>
+#include <cstdio>
+#include <functional>
+#include <string_view>
+
+
+using namespace doggy;
+
+bool RepeatCollapser::HashHeader(std::string_view line, size_t& hash, size_t& len, uint64_t& seq) const
+{
+    seq = 0;
+    if(sequence_numbers_ && !line.empty() && line[0] == '#')
+    {
+        auto end = line.find(' ');
+        if(end != std::string_view::npos)
+        {
+            std::from_chars(line.data() + 1, line.data() + end, seq);
+            line.remove_prefix(end + 1);
+        }
+    }
+    // 日志头部形如"[LEVEL]YYYY-MM-DD HH:MM:SS ...", 跳过日期和时间两个字段
+    if(line.size() < 3 || line[0] != '[')
+    {
+        return false;
+    }
+    auto close = line.find(']');
+    if(close == std::string_view::npos || close < 2 || close + 1 >= line.size() || line[close + 1] < '0' || line[close + 1] > '9')
+    {
+        return false;
+    }
+    for(size_t i = 1; i < close; ++i)
+    {
+        if(line[i] < 'A' || line[i] > 'Z')
+        {
+            return false;
+        }
+    }
+    auto date_end = line.find(' ', close);
+    auto time_end = date_end == std::string_view::npos ? date_end : line.find(' ', date_end + 1);
+    if(time_end == std::string_view::npos)
+    {
+        return false;
+    }
+    std::string_view level = line.substr(0, close + 1);
+    line.remove_prefix(time_end);
+    len = level.size() + line.size();
+    std::hash<std::string_view> hasher;
+    hash = hasher(level) * 31 ^ hasher(line);
+    return true;
+}
+
+void RepeatCollapser::EndRecord(std::string_view data, size_t begin, size_t end, size_t& run_begin, LogFile& output)
+{
+    if(has_last_ && cur_hash_ == last_hash_ && cur_len_ == last_len_)
+    {
+        // 重复的日志: 先写出之前积累的非重复日志, 再跳过这一条
+        output.Append(data.substr(run_begin, begin - run_begin));
+        run_begin = end;
+        if(repeats_++ == 0)
+        {
+            first_seq_ = cur_seq_;
+        }
+        last_seq_ = cur_seq_;
+    }
+    else
+    {
+        if(repeats_ > 0)
+        {
+            output.Append(data.substr(run_begin, begin - run_begin));
+            run_begin = begin;
+            Finish(output, false);
+        }
+        has_last_ = true;
+        last_hash_ = cur_hash_;
+        last_len_ = cur_len_;
+    }
+}
+
+void RepeatCollapser::Write(std::string_view data, LogFile& output)
+{
+    std::hash<std::string_view> hasher;
+    size_t run_begin = 0;
+    // 当前带头部日志的起点, npos表示当前不在带头部的日志中
+    size_t record_begin = std::string_view::npos;
+    size_t pos = 0;
+    while(pos < data.size())
+    {
+        auto eol = data.find('\n', pos);
+        size_t next = eol == std::string_view::npos ? data.size() : eol + 1;
+        std::string_view line = data.substr(pos, next - pos);
+        size_t hash;
+        size_t len;
+        uint64_t seq;
+        if(HashHeader(line, hash, len, seq))
+        {
+            if(record_begin != std::string_view::npos)
+            {
+                EndRecord(data, record_begin, pos, run_begin, output);
+            }
+            record_begin = pos;
+            cur_hash_ = hash;
+            cur_len_ = len;
+            cur_seq_ = seq;
+        }
+        else if(record_begin != std::string_view::npos)
+        {
+            // 延续行属于当前日志, 一起参与比较
+            cur_hash_ = cur_hash_ * 31 ^ hasher(line);
+            cur_len_ += line.size();
+        }
+        else if(has_last_ || repeats_ > 0)
+        {
+            // 不属于任何带头部日志的行: 在它之前写出挂起的重复计数, 并且不再与上一条日志比较
+            output.Append(data.substr(run_begin, pos - run_begin));
+            run_begin = pos;
+            Finish(output, true);
+        }
+        pos = next;
+    }
+    // 数据的结尾总是一条日志的结尾
+    if(record_begin != std::string_view::npos)
+    {
+        EndRecord(data, record_begin, data.size(), run_begin, output);
+    }
+    output.Append(data.substr(run_begin));
+}
+
+void RepeatCollapser::Finish(LogFile& output, bool forget)
+{
+    if(repeats_ > 0)
+    {
+        char buf[128];
+        if(sequence_numbers_)
+        {
+            std::snprintf(buf, sizeof(buf), "last message repeated %lu times (records %lu-%lu)\n",
+                static_cast<unsigned long>(repeats_), static_cast<unsigned long>(first_seq_), static_cast<unsigned long>(last_seq_));
+        }
+        else
+        {
+            std::snprintf(buf, sizeof(buf), "last message repeated %lu times\n", static_cast<unsigned long>(repeats_));
+        }
+        output.Append(buf);
+        repeats_ = 0;
+    }
+    if(forget)
+    {
+        has_last_ = false;
+    }
+}
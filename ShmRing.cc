@@ -0,0 +1,361 @@
+#include "include/ShmRing.h"
+#include "include/CurrentThread.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <thread>
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+
+namespace doggy::detail
+{
+
+constexpr uint32_t SHMRING_MAGIC = 0x474f4444; // "DDOG"
+constexpr uint32_t SHMRING_VERSION = 2;
+// 数据区从第一个页边界开始
+constexpr size_t SHMRING_HEADER_SIZE = 4096;
+constexpr size_t SHMRING_RECORD_ALIGN = 16;
+
+struct ShmRingHeader
+{
+    // 由创建者在初始化完成后以release语义写入, 附着者据此判断共享内存是否可用
+    std::atomic<uint32_t> magic;
+    uint32_t version;
+    uint64_t capacity;
+    // 生产者侧: 预留位置与丢弃计数
+    alignas(64) std::atomic<uint64_t> reserve_pos;
+    std::atomic<uint64_t> dropped;
+    // 消费者侧: 读位置与跳过计数
+    alignas(64) std::atomic<uint64_t> read_pos;
+    std::atomic<uint64_t> abandoned;
+};
+
+static_assert(sizeof(ShmRingHeader) <= SHMRING_HEADER_SIZE);
+static_assert(std::atomic<uint64_t>::is_always_lock_free, "ShmRing requires address-free 64-bit atomics");
+
+// 记录的状态转换: 生产者EMPTY -> WRITING -> DATA; 消费者只在生产者线程已经不存在时
+// 把EMPTY或WRITING改为ABANDONED. 两方都用CAS, 因此同一条记录只会有一方成功
+enum RecordState : uint32_t
+{
+    RECORD_EMPTY = 0,
+    RECORD_DATA = 1,
+    RECORD_PADDING = 2,
+    RECORD_WRITING = 3,
+    RECORD_ABANDONED = 4,
+};
+
+struct RecordHeader
+{
+    std::atomic<uint32_t> state;
+    // 包括记录头和对齐填充在内的总字节数, 在状态离开EMPTY之前以release语义写入
+    std::atomic<uint32_t> size;
+    // 日志内容的字节数
+    uint32_t len;
+    // 写入这条记录的线程的tid, 消费者据此判断生产者是否已经崩溃
+    std::atomic<uint32_t> owner;
+};
+
+static_assert(sizeof(RecordHeader) == SHMRING_RECORD_ALIGN);
+
+inline uint64_t AlignUp(uint64_t n, uint64_t align)
+{
+    return (n + align - 1) & ~(align - 1);
+}
+
+inline std::string ShmName(const std::string& name)
+{
+    return (!name.empty() && name[0] == '/') ? name : "/" + name;
+}
+
+} // end namespace doggy::detail
+
+using namespace doggy;
+using namespace doggy::detail;
+
+
+std::shared_ptr<ShmRing> ShmRing::Create(const std::string& name, size_t capacity)
+{
+    size_t cap = SHMRING_HEADER_SIZE;
+    while(cap < capacity)
+    {
+        cap <<= 1;
+    }
+    int fd = ::shm_open(ShmName(name).c_str(), O_RDWR | O_CREAT | O_EXCL, 0644);
+    if(fd < 0 && errno == EEXIST)
+    {
+        return Open(name);
+    }
+    if(fd < 0 || ::ftruncate(fd, SHMRING_HEADER_SIZE + cap) != 0)
+    {
+        std::fprintf(stderr, "ShmRing: cannot create %s: %s\n", name.c_str(), std::strerror(errno));
+        if(fd >= 0)
+        {
+            ::close(fd);
+        }
+        return nullptr;
+    }
+    return Map(name, fd, cap, true);
+}
+
+std::shared_ptr<ShmRing> ShmRing::Open(const std::string& name)
+{
+    int fd = ::shm_open(ShmName(name).c_str(), O_RDWR, 0);
+    if(fd < 0)
+    {
+        std::fprintf(stderr, "ShmRing: cannot open %s: %s\n", name.c_str(), std::strerror(errno));
+        return nullptr;
+    }
+    // 创建者可能还没来得及设置大小, 稍作等待
+    struct stat st{};
+    for(int i = 0; i < 1000; ++i)
+    {
+        if(::fstat(fd, &st) == 0 && static_cast<size_t>(st.st_size) > SHMRING_HEADER_SIZE)
+        {
+            break;
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    if(static_cast<size_t>(st.st_size) <= SHMRING_HEADER_SIZE)
+    {
+        std::fprintf(stderr, "ShmRing: %s is not initialized\n", name.c_str());
+        ::close(fd);
+        return nullptr;
+    }
+    return Map(name, fd, st.st_size - SHMRING_HEADER_SIZE, false);
+}
+
+void ShmRing::Unlink(const std::string& name)
+{
+    ::shm_unlink(ShmName(name).c_str());
+}
+
+std::shared_ptr<ShmRing> ShmRing::Map(const std::string& name, int fd, size_t capacity, bool create)
+{
+    size_t mapped_size = SHMRING_HEADER_SIZE + capacity;
+    void* addr = ::mmap(nullptr, mapped_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if(addr == MAP_FAILED)
+    {
+        std::fprintf(stderr, "ShmRing: cannot map %s: %s\n", name.c_str(), std::strerror(errno));
+        return nullptr;
+    }
+    auto header = static_cast<ShmRingHeader*>(addr);
+    if(create)
+    {
+        // ftruncate得到的内存全部为零, 只需要填写元数据
+        header->version = SHMRING_VERSION;
+        header->capacity = capacity;
+        header->magic.store(SHMRING_MAGIC, std::memory_order_release);
+    }
+    else
+    {
+        for(int i = 0; i < 1000 && header->magic.load(std::memory_order_acquire) != SHMRING_MAGIC; ++i)
+        {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+        if(header->magic.load(std::memory_order_acquire) != SHMRING_MAGIC
+           || header->version != SHMRING_VERSION || header->capacity != capacity)
+        {
+            std::fprintf(stderr, "ShmRing: %s has an incompatible layout\n", name.c_str());
+            ::munmap(addr, mapped_size);
+            return nullptr;
+        }
+    }
+    return std::shared_ptr<ShmRing>(new ShmRing(header, mapped_size));
+}
+
+ShmRing::ShmRing(ShmRingHeader* header, size_t mapped_size)
+    : header_(header),
+      data_(reinterpret_cast<char*>(header) + SHMRING_HEADER_SIZE),
+      mapped_size_(mapped_size),
+      capacity_(header->capacity),
+      stalled_pos_(UINT64_MAX),
+      stalled_reserved_(0)
+{
+
+}
+
+ShmRing::~ShmRing()
+{
+    ::munmap(header_, mapped_size_);
+}
+
+bool ShmRing::Write(std::string_view logline)
+{
+    const uint64_t total = AlignUp(sizeof(RecordHeader) + logline.size(), SHMRING_RECORD_ALIGN);
+    if(total > capacity_ / 4)
+    {
+        header_->dropped.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+
+    // 预留空间: 如果记录在环尾放不下, 就连同尾部剩余空间一起预留, 尾部写一条填充记录
+    uint64_t pos = header_->reserve_pos.load(std::memory_order_relaxed);
+    uint64_t contiguous;
+    do
+    {
+        contiguous = capacity_ - (pos & (capacity_ - 1));
+        uint64_t need = contiguous < total ? contiguous + total : total;
+        if(pos + need - header_->read_pos.load(std::memory_order_acquire) > capacity_)
+        {
+            header_->dropped.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        }
+        if(header_->reserve_pos.compare_exchange_weak(pos, pos + need, std::memory_order_acq_rel, std::memory_order_relaxed))
+        {
+            break;
+        }
+    }while(true);
+
+    const uint32_t owner = static_cast<uint32_t>(CurrentThread::Tid());
+    if(contiguous < total)
+    {
+        auto padding = reinterpret_cast<RecordHeader*>(data_ + (pos & (capacity_ - 1)));
+        padding->owner.store(owner, std::memory_order_relaxed);
+        padding->size.store(static_cast<uint32_t>(contiguous), std::memory_order_release);
+        uint32_t expected = RECORD_EMPTY;
+        padding->state.compare_exchange_strong(expected, RECORD_PADDING, std::memory_order_acq_rel);
+        pos += contiguous;
+    }
+
+    auto record = reinterpret_cast<RecordHeader*>(data_ + (pos & (capacity_ - 1)));
+    record->owner.store(owner, std::memory_order_relaxed);
+    record->len = static_cast<uint32_t>(logline.size());
+    record->size.store(static_cast<uint32_t>(total), std::memory_order_release);
+    // 认领: 失败说明消费者已经认定本线程崩溃并跳过了这段空间, 此后不能再写入
+    uint32_t expected = RECORD_EMPTY;
+    if(!record->state.compare_exchange_strong(expected, RECORD_WRITING, std::memory_order_acq_rel))
+    {
+        header_->dropped.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+    std::memcpy(reinterpret_cast<char*>(record) + sizeof(RecordHeader), logline.data(), logline.size());
+    // 提交: 此后消费者可以看到完整的记录
+    expected = RECORD_WRITING;
+    if(!record->state.compare_exchange_strong(expected, RECORD_DATA, std::memory_order_acq_rel))
+    {
+        header_->dropped.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+    return true;
+}
+
+size_t ShmRing::Drain(const RecordFunc& func, size_t max_records, std::chrono::milliseconds abandon_timeout)
+{
+    // 把[pos, pos+len)清零, 区间可能跨越环尾
+    auto release = [this](uint64_t pos, uint64_t len)
+    {
+        while(len > 0)
+        {
+            uint64_t offset = pos & (capacity_ - 1);
+            uint64_t chunk = std::min(len, capacity_ - offset);
+            std::memset(data_ + offset, 0, chunk);
+            pos += chunk;
+            len -= chunk;
+        }
+    };
+
+    size_t count = 0;
+    uint64_t pos = header_->read_pos.load(std::memory_order_relaxed);
+    while(count < max_records)
+    {
+        uint64_t reserved = header_->reserve_pos.load(std::memory_order_acquire);
+        if(pos == reserved)
+        {
+            break;
+        }
+        auto record = reinterpret_cast<RecordHeader*>(data_ + (pos & (capacity_ - 1)));
+        uint32_t state = record->state.load(std::memory_order_acquire);
+        uint64_t size = record->size.load(std::memory_order_acquire);
+        if(state == RECORD_EMPTY || state == RECORD_WRITING)
+        {
+            // 记录已预留但尚未提交: 通常是生产者正在拷贝, 超时后检查生产者线程是否还存在
+            auto now = std::chrono::steady_clock::now();
+            if(stalled_pos_ != pos)
+            {
+                stalled_pos_ = pos;
+                stalled_since_ = now;
+                stalled_reserved_ = reserved;
+                break;
+            }
+            if(now - stalled_since_ < abandon_timeout)
+            {
+                break;
+            }
+            // 生产者线程仍然存在时(被抢占或暂停)它随时可能继续写入, 跳过会破坏环, 只能继续等待
+            const pid_t owner = static_cast<pid_t>(record->owner.load(std::memory_order_relaxed));
+            const bool owner_dead = owner != 0 && ::kill(owner, 0) != 0 && errno == ESRCH;
+            if(size == 0 && (owner == 0 || owner_dead))
+            {
+                // 生产者在预留空间之后、写入记录大小之前崩溃, 无法从记录头得知它的范围.
+                // 它没有写入任何内容, 这段空间仍然全零; 向后找到第一个非零的记录头, 即下一条记录的起点.
+                // 只在停顿开始时已经预留的范围内查找: 这些预留都已超过abandon_timeout仍未写入记录头
+                size = ResyncFrom(pos, stalled_reserved_);
+                if(size == 0)
+                {
+                    stalled_since_ = now;
+                    break;
+                }
+                header_->abandoned.fetch_add(1, std::memory_order_relaxed);
+                std::fprintf(stderr, "ShmRing: skipped %lu bytes reserved by a crashed producer\n", static_cast<unsigned long>(size));
+            }
+            else if(size == 0 || !owner_dead)
+            {
+                stalled_since_ = now;
+                break;
+            }
+            else if(!record->state.compare_exchange_strong(state, RECORD_ABANDONED, std::memory_order_acq_rel))
+            {
+                // 状态刚刚发生了变化, 重新检查这条记录
+                continue;
+            }
+            else
+            {
+                header_->abandoned.fetch_add(1, std::memory_order_relaxed);
+            }
+        }
+        else if(state == RECORD_DATA)
+        {
+            func(std::string_view(reinterpret_cast<const char*>(record) + sizeof(RecordHeader), record->len));
+            ++count;
+        }
+        release(pos, size);
+        pos += size;
+        header_->read_pos.store(pos, std::memory_order_release);
+    }
+    return count;
+}
+
+uint64_t ShmRing::ResyncFrom(uint64_t pos, uint64_t limit) const
+{
+    // 空闲空间总是全零, 生产者又总是先写记录头再写内容, 因此pos处的记录头之后第一个非零的对齐单元就是下一条记录的记录头
+    for(uint64_t next = pos + SHMRING_RECORD_ALIGN; next < limit; next += SHMRING_RECORD_ALIGN)
+    {
+        auto record = reinterpret_cast<const RecordHeader*>(data_ + (next & (capacity_ - 1)));
+        if(record->state.load(std::memory_order_acquire) != RECORD_EMPTY
+           || record->size.load(std::memory_order_acquire) != 0
+           || record->owner.load(std::memory_order_relaxed) != 0
+           || record->len != 0)
+        {
+            return next - pos;
+        }
+    }
+    return limit > pos ? limit - pos : 0;
+}
+
+uint64_t ShmRing::Dropped() const noexcept
+{
+    return header_->dropped.load(std::memory_order_relaxed);
+}
+
+uint64_t ShmRing::Abandoned() const noexcept
+{
+    return header_->abandoned.load(std::memory_order_relaxed);
+}
\ No newline at end of file
@@ -0,0 +1,222 @@
+#include "include/TscClock.h"
+
+#include <algorithm>
+#include <charconv>
+#include <cstring>
+#include <ctime>
+#include <mutex>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>
+#endif
+
+
+namespace doggy::detail
+{
+
+// 初始校准时两次采样的间隔
+constexpr int64_t TSC_INITIAL_CALIBRATION_NS = 2 * 1000 * 1000;
+// 映射领先于CLOCK_REALTIME时, 计划在这么长的时间内追平
+constexpr double TSC_SLEW_NS = 1000.0 * 1000 * 1000;
+// 追赶时斜率最多放慢到原来的一半, 映射始终是递增的
+constexpr double TSC_MIN_SLEW_RATE = 0.5;
+
+std::mutex tsc_mutex;
+bool tsc_calibrated = false;
+// 第一次采样: 斜率以CLOCK_MONOTONIC_RAW为基准, 不受NTP调整和时间跳变的影响
+uint64_t anchor_ticks = 0;
+int64_t anchor_raw_ns = 0;
+TscCalibration tsc_calibration;
+
+inline int64_t ToNanos(const timespec& ts)
+{
+    return static_cast<int64_t>(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+}
+
+// 采样一组(tick, CLOCK_REALTIME, CLOCK_MONOTONIC_RAW), tick取两次读数的中点
+void Sample(uint64_t& ticks, int64_t& real_ns, int64_t& raw_ns)
+{
+    timespec real;
+    timespec raw;
+    uint64_t t0 = TscClock::Now();
+    ::clock_gettime(CLOCK_REALTIME, &real);
+    ::clock_gettime(CLOCK_MONOTONIC_RAW, &raw);
+    uint64_t t1 = TscClock::Now();
+    ticks = t0 + (t1 - t0) / 2;
+    real_ns = ToNanos(real);
+    raw_ns = ToNanos(raw);
+}
+
+// 在持有tsc_mutex时调用
+void CalibrateLocked()
+{
+    uint64_t ticks;
+    int64_t real_ns;
+    int64_t raw_ns;
+    if(!tsc_calibrated)
+    {
+        Sample(anchor_ticks, real_ns, anchor_raw_ns);
+        do
+        {
+            Sample(ticks, real_ns, raw_ns);
+        }while(raw_ns - anchor_raw_ns < TSC_INITIAL_CALIBRATION_NS);
+        tsc_calibrated = true;
+        tsc_calibration.base_ticks = ticks;
+        tsc_calibration.base_ns = real_ns;
+        tsc_calibration.ns_per_tick = static_cast<double>(raw_ns - anchor_raw_ns) / static_cast<double>(ticks - anchor_ticks);
+        tsc_calibration.prev_ns_per_tick = tsc_calibration.ns_per_tick;
+        return;
+    }
+    Sample(ticks, real_ns, raw_ns);
+    if(ticks <= tsc_calibration.base_ticks)
+    {
+        return;
+    }
+    const double raw_slope = static_cast<double>(raw_ns - anchor_raw_ns) / static_cast<double>(ticks - anchor_ticks);
+    // 从上一段映射在当前时刻的取值继续, 不直接采用新的CLOCK_REALTIME样本:
+    // 样本落后时(NTP回拨或者向后微调)放慢斜率逐渐追平, 超前时向前跳, 两种情况下映射都不会倒退
+    const int64_t current_ns = tsc_calibration.ToNanos(ticks);
+    const int64_t error_ns = real_ns - current_ns;
+    tsc_calibration.prev_ns_per_tick = tsc_calibration.ns_per_tick;
+    tsc_calibration.base_ticks = ticks;
+    if(error_ns >= 0)
+    {
+        tsc_calibration.base_ns = real_ns;
+        tsc_calibration.ns_per_tick = raw_slope;
+    }
+    else
+    {
+        tsc_calibration.base_ns = current_ns;
+        tsc_calibration.ns_per_tick = raw_slope * std::max(TSC_MIN_SLEW_RATE, 1.0 + static_cast<double>(error_ns) / TSC_SLEW_NS);
+    }
+}
+
+struct DateCache
+{
+    time_t second = -1;
+    // "YYYY-MM-DD HH:MM:SS"
+    char text[20];
+};
+
+thread_local DateCache t_date_cache;
+
+constexpr char hex_digits[] = "0123456789abcdef";
+
+} // end namespace doggy::detail
+
+using namespace doggy;
+using namespace doggy::detail;
+
+
+bool TscClock::Invariant()
+{
+    static const bool invariant = []
+    {
+#if defined(__x86_64__) || defined(__i386__)
+        unsigned int eax, ebx, ecx, edx;
+        // CPUID.80000007H:EDX[8]为invariant TSC
+        return __get_cpuid(0x80000007, &eax, &ebx, &ecx, &edx) != 0 && (edx & (1u << 8)) != 0;
+#else
+        return false;
+#endif
+    }();
+    return invariant;
+}
+
+void TscClock::Recalibrate()
+{
+    std::lock_guard<std::mutex> lg(tsc_mutex);
+    CalibrateLocked();
+}
+
+TscCalibration TscClock::GetCalibration()
+{
+    std::lock_guard<std::mutex> lg(tsc_mutex);
+    if(!tsc_calibrated)
+    {
+        CalibrateLocked();
+    }
+    return tsc_calibration;
+}
+
+size_t doggy::FormatWallTime(int64_t ns, char* buf)
+{
+    time_t second = static_cast<time_t>(ns / 1000000000);
+    long nanos = static_cast<long>(ns % 1000000000);
+    auto& cache = t_date_cache;
+    if(cache.second != second)
+    {
+        std::tm tm;
+        ::localtime_r(&second, &tm);
+        std::strftime(cache.text, sizeof(cache.text), "%Y-%m-%d %H:%M:%S", &tm);
+        cache.second = second;
+    }
+    std::memcpy(buf, cache.text, 19);
+    buf[19] = '.';
+    for(int i = 29; i > 20; --i)
+    {
+        buf[i - 1] = static_cast<char>('0' + nanos % 10);
+        nanos /= 10;
+    }
+    return 29;
+}
+
+void doggy::FormatTscPlaceholder(uint64_t ticks, char* buf)
+{
+    buf[0] = '@';
+    for(int i = 16; i > 0; --i)
+    {
+        buf[i] = hex_digits[ticks & 0xf];
+        ticks >>= 4;
+    }
+}
+
+void TscTimestampConverter::Recalibrate()
+{
+    TscClock::Recalibrate();
+    calibration_ = TscClock::GetCalibration();
+    calibrated_ = true;
+}
+
+bool TscTimestampConverter::Convert(std::string_view data, std::string& out)
+{
+    // 占位符只可能出现在日志开头的"#序号 [LEVEL]"之后
+    constexpr size_t KMAX_PLACEHOLDER_OFFSET = 48;
+    bool found = false;
+    size_t run_begin = 0;
+    size_t pos = 0;
+    while(pos < data.size())
+    {
+        auto eol = data.find('\n', pos);
+        size_t next = eol == std::string_view::npos ? data.size() : eol + 1;
+        auto line = data.substr(pos, std::min(next - pos, KMAX_PLACEHOLDER_OFFSET + TSC_PLACEHOLDER_SIZE));
+        auto marker = line.find("]@");
+        uint64_t ticks = 0;
+        if(marker != std::string_view::npos && marker + 1 + TSC_PLACEHOLDER_SIZE <= line.size()
+           && std::from_chars(line.data() + marker + 2, line.data() + marker + 1 + TSC_PLACEHOLDER_SIZE, ticks, 16).ptr
+              == line.data() + marker + 1 + TSC_PLACEHOLDER_SIZE)
+        {
+            if(!found)
+            {
+                found = true;
+                out.clear();
+                if(!calibrated_)
+                {
+                    calibration_ = TscClock::GetCalibration();
+                    calibrated_ = true;
+                }
+            }
+            char time[32];
+            size_t len = FormatWallTime(calibration_.ToNanos(ticks), time);
+            out.append(data.substr(run_begin, pos + marker + 1 - run_begin));
+            out.append(time, len);
+            run_begin = pos + marker + 1 + TSC_PLACEHOLDER_SIZE;
+        }
+        pos = next;
+    }
+    if(found)
+    {
+        out.append(data.substr(run_begin));
+    }
+    return found;
+}
\ No newline at end of file
@@ -1,14 +1,102 @@
 #ifndef _ASYNCLOG_
 #define _ASYNCLOG_
 
+#include <array>
+#include <chrono>
+#include <cstdint>
 #include <filesystem>
 #include <string_view>
 #include <memory>
 
-namespace doggy 
+#include "LogFile.h"
+
+namespace doggy
 {
 
 class AsyncLogImpl;
+class AsyncLogWriter;
+enum class LogLevel;
+
+// AsyncLog缓冲区的默认容量
+constexpr size_t DEFAULT_ASYNCLOG_BUFFER_SIZE = 4000 * 1024;
+
+// AsyncLog的可选配置
+struct AsyncLogOptions
+{
+    // 将内存缓存区中日志强制flush到文件的最大间隔, 毫秒精度, 至少为1毫秒
+    std::chrono::milliseconds flush_interval{3000};
+    // 自适应唤醒: 待写入字节数达到该值时唤醒后台线程, 0表示不启用
+    size_t wake_bytes = 0;
+    // 自适应唤醒: 最早一条待写入日志的最大等待时长, 超过即唤醒后台线程, 0表示不启用
+    std::chrono::milliseconds max_delay{0};
+    // 持久化模式: 后台线程每次写文件后调用fdatasync, 并唤醒等待落盘的调用者
+    bool durable = false;
+    // 组提交的目标延迟: 第一个等待者到达后, 后台线程最多再等待这么久以聚合更多等待者
+    std::chrono::microseconds sync_latency{2000};
+    // 在每条日志前输出"#序号 ", 序号从1开始单调递增, 便于下游校验日志是否完整
+    bool sequence_numbers = false;
+    // 后台线程合并连续重复的日志(调用点和内容相同, 忽略时间戳), 只写出第一条并附上
+    // "last message repeated N times"
+    bool collapse_repeats = false;
+    // 日志文件的写入方式(预分配、移出page cache、直接I/O)
+    LogFileOptions file;
+    // 缓冲区的容量(字节); 超过该大小的单条日志使用单独分配的缓冲区
+    size_t buffer_size = DEFAULT_ASYNCLOG_BUFFER_SIZE;
+    // 常驻的缓冲区数量(包括前台正在使用的两个和后台线程备用的两个), 至少为4;
+    // 超出4个的部分预先分配, 日志突增时无需再临时分配
+    size_t buffer_count = 4;
+    // 高水位: 一轮中堆积的缓冲区超过该数量时, 只写出前两个, 其余的日志被丢弃; 至少为2
+    size_t high_water = 25;
+    // 自动调节: 后台线程根据每轮写出的字节数调整缓冲区容量(不超过buffer_size)、常驻数量和高水位,
+    // 缓冲区占用的内存不超过memory_limit
+    bool auto_tune = false;
+    // 自动调节时的内存上限, 0表示buffer_size * high_water. 计入两个通道、缓冲池和后台线程持有的全部缓冲区;
+    // 普通日志需要新的缓冲区而会超出上限时被丢弃, 在文件中留下缺口标记; 高优先级日志计入用量但不会被丢弃
+    size_t memory_limit = 0;
+    // 由共享的写线程完成写出, 不再创建独占的后台线程; 共享同一写线程的实例应使用不同的输出目录
+    std::shared_ptr<AsyncLogWriter> writer;
+};
+
+// 日志堆积或超出内存上限时被丢弃的日志的累计统计
+struct AsyncLogLossStats
+{
+    // 追加过的日志条数
+    uint64_t records = 0;
+    // 被丢弃的日志条数与字节数
+    uint64_t dropped_records = 0;
+    uint64_t dropped_bytes = 0;
+    // 发生丢弃的次数, 每次丢弃都会在日志文件中留下一条序号区间的标记
+    uint64_t drop_events = 0;
+};
+
+// 当前的缓冲区配置, 启用自动调节时随负载变化
+struct AsyncLogBufferStats
+{
+    size_t buffer_size = 0;
+    size_t buffer_count = 0;
+    size_t high_water = 0;
+    // 写出速率的滑动平均, 折算为每个flush间隔的字节数; 缓冲区写满时一轮远短于flush间隔, 不是每轮的写出量
+    size_t bytes_per_interval = 0;
+    // 自动调节改变配置的次数
+    uint64_t retunes = 0;
+};
+
+// 持久化模式下组提交(group commit)的统计信息
+struct AsyncLogSyncStats
+{
+    // fdatasync的调用次数
+    uint64_t syncs = 0;
+    // 被唤醒的等待者总数
+    uint64_t waiters = 0;
+    // 单次fdatasync服务的最多等待者数
+    uint64_t max_batch = 0;
+    // fdatasync的累计耗时
+    std::chrono::microseconds sync_time{0};
+    // 未能落盘的批次数: fdatasync失败, 或者本批次中有日志因堆积被丢弃
+    uint64_t failures = 0;
+    // 批大小分布, 按2的幂分桶: [0], [1], [2,3], [4,7], ..., [64,+inf)
+    std::array<uint64_t, 8> batch_histogram{};
+};
 
 // AsyncLog类的功能是接收日志输入, 在后台线程中将日志输出到文件中
 class AsyncLog final
@@ -17,6 +105,7 @@ public:
     // dir_path : 日志文件的输出目录
     // flush_interval_s : 将内存缓存区中日志强制flush到文件的最大间隔秒数
     AsyncLog(const std::filesystem::path& dir_path, int flush_interval_s = 3);
+    AsyncLog(const std::filesystem::path& dir_path, const AsyncLogOptions& options);
 
     ~AsyncLog();
     // 不允许拷贝
@@ -24,8 +113,19 @@ public:
     AsyncLog& operator=(const AsyncLog&) = delete;
 
     void Append(const std::string_view logline);
+    // 按日志级别分通道: WARN及以上的日志进入高优先级通道, 立即唤醒后台线程并优先写出, 不会被丢弃
+    void AppendLevel(const std::string_view logline, LogLevel level);
+    // 追加日志并阻塞, 直到这条日志被fdatasync落盘; 返回false表示这条日志或者它之前尚未落盘的日志
+    // 因堆积被丢弃、fdatasync失败或者AsyncLog已经停止. 非持久化模式下等同于Append并返回false
+    bool AppendDurable(const std::string_view logline);
+    // 阻塞直到调用之前追加的所有日志落盘, 返回值的含义与AppendDurable相同; 非持久化模式下立即返回false
+    bool WaitDurable();
     void Stop();
-    
+
+    AsyncLogSyncStats GetSyncStats() const;
+    AsyncLogLossStats GetLossStats() const;
+    AsyncLogBufferStats GetBufferStats() const;
+
 private:
     std::unique_ptr<AsyncLogImpl> impl_;
 };
@@ -0,0 +1,81 @@
+#ifndef _ASYNCLOGWRITER_
+#define _ASYNCLOGWRITER_
+
+#include <chrono>
+#include <cstddef>
+#include <memory>
+#include <vector>
+
+namespace doggy
+{
+
+class AsyncLog;
+class AsyncLogImpl;
+class AsyncLogWriterImpl;
+
+namespace detail
+{
+// 由AsyncLogWriter驱动的写出任务, 由AsyncLogImpl实现
+class WriterTask
+{
+public:
+    virtual ~WriterTask() = default;
+    // 检查任务是否到期, 到期时完成一轮写出; 返回下一次需要检查的时刻,
+    // time_point::max()表示不再需要检查
+    virtual std::chrono::steady_clock::time_point Service() = 0;
+};
+}
+
+// AsyncLogWriter的可选配置
+struct AsyncLogWriterOptions
+{
+    // 写线程的数量, 至少为1
+    size_t threads = 1;
+    // 将写线程绑定到这些CPU上, 为空表示不绑定
+    std::vector<int> cpus;
+    // 将写线程绑定到该NUMA节点的所有CPU上(取自/sys/devices/system/node), -1表示不绑定;
+    // 与cpus同时指定时取两者的交集
+    int numa_node = -1;
+    // 时间轮的刻度, flush截止时刻按刻度向上取整
+    std::chrono::milliseconds tick{1};
+};
+
+// AsyncLogWriter是可由多个AsyncLog实例共享的写线程(池)
+// 每个AsyncLog默认独占一个后台线程; 进程中有许多日志实例时, 它们大多数时间都在空转.
+// 在AsyncLogOptions::writer中指定同一个AsyncLogWriter后, 这些实例不再创建自己的线程,
+// 而是由写线程用时间轮管理各自的flush截止时刻, 轮流完成写出. 每个实例仍然使用自己的
+// 缓冲区和日志文件, 同一实例同一时刻只会被一个写线程处理
+class AsyncLogWriter final
+{
+public:
+    static std::shared_ptr<AsyncLogWriter> Create(const AsyncLogWriterOptions& options = AsyncLogWriterOptions());
+
+    // 所有使用它的AsyncLog都持有其shared_ptr, 因此析构时已经没有挂接的实例
+    ~AsyncLogWriter();
+    // 不允许拷贝
+    AsyncLogWriter(const AsyncLogWriter&) = delete;
+    AsyncLogWriter& operator=(const AsyncLogWriter&) = delete;
+
+    // 当前挂接的AsyncLog实例数
+    size_t Instances() const;
+
+private:
+    friend class AsyncLog;
+    friend class AsyncLogImpl;
+
+    explicit AsyncLogWriter(const AsyncLogWriterOptions& options);
+
+    // 挂接一个任务, 在first_check时刻第一次检查它
+    void Attach(detail::WriterTask* task, std::chrono::steady_clock::time_point first_check);
+    // 等待正在进行的写出完成后摘除任务, 返回后写线程不会再访问它
+    void Detach(detail::WriterTask* task);
+    // 让写线程尽快检查该任务; 可以在持有任务自身的锁时调用
+    void Wake(detail::WriterTask* task);
+
+private:
+    std::unique_ptr<AsyncLogWriterImpl> impl_;
+};
+
+} // end namespace doggy
+
+#endif
@@ -0,0 +1,29 @@
+#ifndef _CURRENTTHREAD_
+#define _CURRENTTHREAD_
+
+#include <string_view>
+#include <sys/types.h>
+
+namespace doggy::CurrentThread
+{
+
+// CurrentThread负责缓存当前线程的身份信息(tid和线程名), 供日志头部使用
+// 信息只在线程第一次打日志、调用SetName改名以及fork之后才重新获取并格式化,
+// 其余时候读取线程局部缓存, 不会产生gettid/pthread_getname_np系统调用
+// 注意: 绕过SetName直接用pthread_setname_np或prctl(PR_SET_NAME)改名(例如第三方库、线程池)时,
+// 缓存无法感知, 日志头部仍是旧的名字; 这种情况下需要在改名之后调用Refresh
+
+// 当前线程的内核线程id
+pid_t Tid();
+// 当前线程的名字
+std::string_view Name();
+// 预先格式化好的"tid name "字段, 可以直接拷贝进日志头部
+std::string_view Header();
+// 修改当前线程的名字(最长15个字符), 并刷新缓存
+void SetName(std::string_view name);
+// 重新获取当前线程的tid和名字, 用于线程被外部改名之后
+void Refresh();
+
+} // end namespace doggy::CurrentThread
+
+#endif
@@ -2,9 +2,11 @@
 #define _FIXEDBUFFER_
 
 #include <array>
+#include <atomic>
 #include <cstddef>
 #include <cstring>
 #include <iostream>
+#include <memory>
 #include <string_view>
 #include <algorithm>
 
@@ -66,6 +68,61 @@ size_t FixedBuffer<SIZE>::Append(const std::string_view sv)
     return bytes_to_append;
 }
 
+// 容量在运行时确定的缓冲区, 接口与FixedBuffer相同, 供AsyncLog按配置分配
+// 指定usage时, 缓冲区在其生命周期内把自己的容量计入*usage, 用于统计内存占用
+class DynamicBuffer final
+{
+public:
+    explicit DynamicBuffer(size_t capacity, std::atomic<size_t>* usage = nullptr)
+        : data_(std::make_unique<char[]>(capacity)), capacity_(capacity), cur_(0), usage_(usage)
+    {
+        if(usage_)
+        {
+            usage_->fetch_add(capacity_, std::memory_order_relaxed);
+        }
+    }
+
+    ~DynamicBuffer()
+    {
+        if(usage_)
+        {
+            usage_->fetch_sub(capacity_, std::memory_order_relaxed);
+        }
+    }
+
+    // 不允许拷贝
+    DynamicBuffer(const DynamicBuffer&)=delete;
+    DynamicBuffer& operator=(const DynamicBuffer&)=delete;
+
+    size_t Append(const std::string_view sv)
+    {
+        std::size_t bytes_to_append = std::min(Avail(), sv.size());
+        std::memcpy(data_.get() + cur_, sv.data(), bytes_to_append);
+        cur_ += bytes_to_append;
+        return bytes_to_append;
+    }
+
+    inline char* Data() const noexcept { return data_.get(); }
+
+    inline size_t Capactiy() const noexcept { return capacity_; }
+
+    inline size_t Size() const noexcept { return cur_; }
+
+    inline size_t Avail() const noexcept { return capacity_ - cur_; }
+
+    inline void Clear() noexcept { cur_ = 0; }
+
+    void Bzero() { cur_ = 0, std::memset(data_.get(), 0, capacity_); }
+
+    inline std::string_view ToStringView() const { return std::string_view(data_.get(), Size()); }
+
+private:
+    std::unique_ptr<char[]> data_;
+    std::size_t capacity_;
+    std::size_t cur_;
+    std::atomic<size_t>* usage_;
+};
+
 } // namespace doggy end
 
 # endif
\ No newline at end of file
@@ -0,0 +1,39 @@
+#ifndef _LOGCONTEXT_
+#define _LOGCONTEXT_
+
+#include <string_view>
+
+namespace doggy
+{
+
+// LogContext是线程局部的日志上下文(MDC), 以栈的形式保存若干key=value
+// 上下文会被渲染成"{key=value key=value} "形式的前缀并缓存, 只有在Push/Pop/Clear
+// 改变上下文后才重新渲染, Logger在生成日志头部时直接拷贝这个前缀
+class LogContext final
+{
+public:
+    LogContext() = delete;
+
+    static void Push(std::string_view key, std::string_view value);
+    static void Pop();
+    static void Clear();
+
+    // 当前线程渲染好的上下文前缀, 上下文为空时返回空串
+    static std::string_view Prefix();
+};
+
+// ScopedLogContext在构造时Push一个key=value, 在析构时Pop
+class ScopedLogContext final
+{
+public:
+    ScopedLogContext(std::string_view key, std::string_view value) { LogContext::Push(key, value); }
+    ~ScopedLogContext() { LogContext::Pop(); }
+
+    // 不允许拷贝
+    ScopedLogContext(const ScopedLogContext&) = delete;
+    ScopedLogContext& operator=(const ScopedLogContext&) = delete;
+};
+
+} // end namespace doggy
+
+#endif
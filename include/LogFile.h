@@ -3,23 +3,39 @@
 
 #include <memory>
 #include <mutex>
+#include <string>
 #include <string_view>
 #include <filesystem>
-#include <fstream>
 
 namespace doggy 
 {
 
 constexpr int MAX_LOGFILE_SIZE = 1024*1024*500;
 
+// LogFile的写入方式, 目的是让大量日志写入不挤占page cache、不在每次文件增长时更新元数据
+struct LogFileOptions
+{
+    // 打开文件时用fallocate预分配MAX_LOGFILE_SIZE的空间(不改变文件大小), 文件关闭时释放多余的部分
+    bool preallocate = true;
+    // 每次Flush后启动新写入部分的回写, 并将已回写的部分用posix_fadvise(DONTNEED)移出page cache
+    bool drop_cache = true;
+    // 使用O_DIRECT绕过page cache写入整块数据, 不足一块的尾部经普通fd写入;
+    // 文件系统不支持时自动退回普通写入
+    bool direct_io = false;
+};
+
 class LogFile : std::enable_shared_from_this<LogFile>
 {
 public:
 
 
-    static std::shared_ptr<LogFile> Create(const std::filesystem::path& dir_path=std::filesystem::current_path(), bool thread_safe = false);
+    // 返回dir_path目录当前使用的日志文件, 每个目录独立地按小时和大小切分文件
+    // options只在需要创建新的日志文件时生效
+    static std::shared_ptr<LogFile> Create(const std::filesystem::path& dir_path=std::filesystem::current_path(), bool thread_safe = false,
+                                           const LogFileOptions& options = LogFileOptions());
 
-    LogFile(const std::filesystem::path& dir_path=std::filesystem::current_path(), bool threadsafe=false);
+    LogFile(const std::filesystem::path& dir_path=std::filesystem::current_path(), bool threadsafe=false,
+            const LogFileOptions& options = LogFileOptions());
     
     ~LogFile();
     // 不允许拷贝
@@ -28,19 +44,47 @@ public:
 
     void Append(std::string_view logs);
     void Flush();
+    // 将缓冲的内容写入文件并通过fdatasync持久化到磁盘, 失败时返回false
+    // 文件是新创建的时, 第一次Sync还会fsync所在目录, 保证掉电后目录项仍然存在
+    // 此前任何一次写入失败都会丢失数据, 之后对本文件的Sync都返回false
+    bool Sync();
 
 private:
     void append(std::string_view logs);
+    void flush();
+    // 将暂存区中的内容写入文件; 直接I/O模式下只写出整块, 不足一块的尾部留在暂存区
+    bool writeStaging(bool whole_blocks_only);
+    // 直接I/O不可用时退回普通写入
+    void disableDirectIo();
+    // 记录一次写入失败, 第一次失败时输出到stderr
+    void writeFailed();
+    // 启动新写入部分的回写, 并把已经回写完成的部分移出page cache
+    void dropWrittenPages();
 private:
     std::filesystem::path file_path_;
     bool thread_safe_;
     std::mutex file_mutex_;
-    std::fstream out_;  
+    LogFileOptions options_;
+    // 直接I/O模式下fd_带有O_DIRECT, tail_fd_是同一文件的普通fd, 用于写不足一块的尾部
+    int fd_;
+    int tail_fd_;
+    // 暂存区, 直接I/O模式下按块对齐, 其起点对应文件中的staged_offset_
+    std::unique_ptr<char, void(*)(void*)> staging_;
+    size_t staging_capacity_;
+    size_t staging_size_;
+    size_t staged_offset_;
+    // 已写入文件的字节数, 以及启动回写、移出page cache的进度
+    size_t file_size_;
+    size_t writeback_offset_;
+    size_t dropped_offset_;
+    bool preallocated_;
+    // 新创建的文件在第一次Sync时还要fsync所在目录, 之后置为true
+    bool dir_synced_;
+    // 有数据未能写入文件, 一旦置位不再清除
+    bool write_failed_;
 
-    static std::shared_ptr<LogFile> current_file_;
-    static std::string current_file_name_;
-    static size_t current_suffix_;
-    static size_t current_file_size_;
+    // 自文件创建以来追加的字节数, 达到MAX_LOGFILE_SIZE时Create会切换到新的文件
+    size_t appended_size_;
 };
 
 } // end namespace doggy
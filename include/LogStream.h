@@ -10,6 +10,11 @@ template <int SIZE>
 class FixedBuffer;
 
 inline constexpr size_t DEFAULT_LOGSTREAM_BUFFER_SIZE = 1024;
+// BasicLogStream只在LogStream.cc中对以下缓冲区大小做了显式实例化
+inline constexpr bool IsSupportedLogStreamSize(size_t size)
+{
+    return size == 256 || size == 1024 || size == 4096 || size == 16384;
+}
 
 // LogStream类负责接收日志流, 它的设计参考了std::ostream, 表现在：
 //  1. 它对各种类型的数据类型重载了“<<运算符”
@@ -19,39 +24,43 @@ inline constexpr size_t DEFAULT_LOGSTREAM_BUFFER_SIZE = 1024;
 // 一个ToStreamView函数负责以string_view的格式读出缓冲区中的数据。
 // 因为LogStream类一定是由Logger类所持有的, 所以在设计中我将输出缓冲区中
 // 内容到目的地的任务放到了Logger类中。
+//
+// 缓冲区大小SIZE是模板参数, 以便StaticLogger按sink类型选择单条日志的最大长度,
+// LogStream是默认大小的别名
 
-class LogStream final
+template <int SIZE>
+class BasicLogStream final
 {    
 public:
-    LogStream();
+    BasicLogStream();
     // 流对象不允许拷贝
-    LogStream(const LogStream&)=delete;
-    LogStream& operator=(const LogStream&)=delete;
+    BasicLogStream(const BasicLogStream&)=delete;
+    BasicLogStream& operator=(const BasicLogStream&)=delete;
 
-    LogStream(LogStream&&);
-    LogStream& operator=(LogStream&&);
+    BasicLogStream(BasicLogStream&&);
+    BasicLogStream& operator=(BasicLogStream&&);
 
-    ~LogStream();
+    ~BasicLogStream();
 
-    LogStream& operator<<(bool b);
-    LogStream& operator<<(char c);
-    LogStream& operator<<(short s);
-    LogStream& operator<<(unsigned short us);
-    LogStream& operator<<(int i);
-    LogStream& operator<<(unsigned int ui);
-    LogStream& operator<<(long l);
-    LogStream& operator<<(unsigned long ul);
-    LogStream& operator<<(long long ll);
-    LogStream& operator<<(unsigned long long ull);
-    LogStream& operator<<(float f);
-    LogStream& operator<<(double d);
-    LogStream& operator<<(const void* p);
-    LogStream& operator<<(const char* str);
-    LogStream& operator<<(const unsigned char* str);
-    LogStream& operator<<(std::string_view sv);
-    LogStream& operator<<( const FixedBuffer<DEFAULT_LOGSTREAM_BUFFER_SIZE>& buffer);
+    BasicLogStream& operator<<(bool b);
+    BasicLogStream& operator<<(char c);
+    BasicLogStream& operator<<(short s);
+    BasicLogStream& operator<<(unsigned short us);
+    BasicLogStream& operator<<(int i);
+    BasicLogStream& operator<<(unsigned int ui);
+    BasicLogStream& operator<<(long l);
+    BasicLogStream& operator<<(unsigned long ul);
+    BasicLogStream& operator<<(long long ll);
+    BasicLogStream& operator<<(unsigned long long ull);
+    BasicLogStream& operator<<(float f);
+    BasicLogStream& operator<<(double d);
+    BasicLogStream& operator<<(const void* p);
+    BasicLogStream& operator<<(const char* str);
+    BasicLogStream& operator<<(const unsigned char* str);
+    BasicLogStream& operator<<(std::string_view sv);
+    BasicLogStream& operator<<( const FixedBuffer<SIZE>& buffer);
 
-    typedef FixedBuffer<DEFAULT_LOGSTREAM_BUFFER_SIZE> Buffer ;
+    typedef FixedBuffer<SIZE> Buffer ;
     
     std::string_view ToStringView() const;
 
@@ -62,5 +71,7 @@ private:
     std::unique_ptr<Buffer> buffer_;
 };
 
+typedef BasicLogStream<DEFAULT_LOGSTREAM_BUFFER_SIZE> LogStream;
+
 } //end namespace doggy
 # endif
\ No newline at end of file
@@ -1,6 +1,9 @@
 #ifndef _LOGGER_
 #define _LOGGER_
 
+#include "LogStream.h"
+
+#include <atomic>
 #include <functional>
 #include <memory>
 #include <string_view>
@@ -9,7 +12,6 @@
 namespace doggy {
 
 class LoggerImpl;
-class LogStream;
 
 enum class LogLevel
 {
@@ -22,6 +24,18 @@ enum class LogLevel
     NUM_LOG_LEVELS,
 };
 
+// 日志头部时间戳的时钟源
+enum class LogClock
+{
+    // std::chrono::system_clock, 精确到秒, 在前台线程格式化
+    SYSTEM = 0,
+    // CPU时间戳计数器: 前台线程只写入tick占位符, 由AsyncLog后台线程换算为纳秒精度的墙上时间;
+    // CPU不提供invariant TSC时退回clock_gettime, 在前台线程格式化为纳秒精度.
+    // 只有AsyncLog和log_collector会换算占位符; 输出到其他目标(包括默认的stdout)时日志中是"@"加十六进制tick,
+    // 这类输出目标需要自行用TscTimestampConverter换算, 否则应使用SYSTEM
+    TSC = 1,
+};
+
 // SourceFile类负责将__FILE__宏转换成“仅包含文件名”的string_view
 // SourceFile类不持有任何资源, 它必须在__FILE__有效时使用
 class SourceFile
@@ -46,6 +60,14 @@ private:
     std::string_view basename_; // 不包含上级路径的纯文件名
 };
 
+namespace detail
+{
+// 向stream写入日志头部: "[LEVEL]时间 tid 线程名 {上下文} 文件名:行号 "
+// 由Logger和StaticLogger共用, 只对IsSupportedLogStreamSize中的大小做了显式实例化
+template <int SIZE>
+void FormatHeader(BasicLogStream<SIZE>& stream, LogLevel level, SourceFile file, int line);
+}
+
 class Logger
 {
 public:
@@ -63,16 +85,28 @@ public:
     LogStream& Stream() const; 
 
     using OutputFunc = std::function<void(std::string_view)>;
+    using LevelOutputFunc = std::function<void(std::string_view, LogLevel)>;
     using FlushFunc = std::function<void()>  ;
     
     static void SetOutputLogLevel(LogLevel level);
     static void SetOutput(const OutputFunc&);
+    // 设置感知日志级别的输出函数, 例如AsyncLog::AppendLevel;
+    // 设置后优先于SetOutput设置的输出函数, 传入空函数即可恢复
+    static void SetLevelOutput(const LevelOutputFunc&);
     static void SetFlush(const FlushFunc&);
     static LogLevel GetOutputLogLevel();
+    static void SetClock(LogClock clock);
+    static LogClock GetClock();
+    // 是否曾经切换到LogClock::TSC: 切回SYSTEM之前写入缓冲区的日志仍带有占位符, 后台线程据此决定是否换算
+    static bool TscClockUsed();
 
     static LogLevel output_level_;
     static OutputFunc output_func_;
+    static LevelOutputFunc level_output_func_;
     static FlushFunc flush_func_;
+    // 前台线程每条日志都会读取, 可能与SetClock并发
+    static std::atomic<LogClock> clock_;
+    static std::atomic<bool> tsc_used_;
 
 private:
     std::unique_ptr<LoggerImpl> impl_;
@@ -82,11 +116,11 @@ private:
 #define LOG_TRACE if (doggy::Logger::GetOutputLogLevel() <= doggy::LogLevel::TRACE) doggy::Logger(__FILE__, __LINE__, doggy::LogLevel::TRACE, __func__).Stream()
 #define LOG_DEBUG if (doggy::Logger::GetOutputLogLevel() <= doggy::LogLevel::DEBUG) doggy::Logger(__FILE__, __LINE__, doggy::LogLevel::DEBUG, __func__).Stream()
 #define LOG_INFO if (doggy::Logger::GetOutputLogLevel() <= doggy::LogLevel::INFO) doggy::Logger(__FILE__, __LINE__, doggy::LogLevel::INFO, __func__).Stream()
-#define LOG_WARN doggy::Logger(__FILE__, __LINE__, doggy::LogLevel::WARN).Stream();
-#define LOG_ERROR doggy::Logger(__FILE__, __LINE__, doggy::LogLevel::ERROR).Stream();
-#define LOG_FATAL doggy::Logger(__FILE__, __LINE__, doggy::LogLevel::FATAL).Stream();
-#define LOG_SYSERR doggy::Logger(__FILE__, __LINE__, false).stream()
-#define LOG_SYSFATAL doggy::Logger(__FILE__, __LINE__, true).stream()
+#define LOG_WARN doggy::Logger(__FILE__, __LINE__, doggy::LogLevel::WARN).Stream()
+#define LOG_ERROR doggy::Logger(__FILE__, __LINE__, doggy::LogLevel::ERROR).Stream()
+#define LOG_FATAL doggy::Logger(__FILE__, __LINE__, doggy::LogLevel::FATAL).Stream()
+#define LOG_SYSERR doggy::Logger(__FILE__, __LINE__, false).Stream()
+#define LOG_SYSFATAL doggy::Logger(__FILE__, __LINE__, true).Stream()
 
 } //end namespace doggy
 
@@ -0,0 +1,50 @@
+#ifndef _REPEATCOLLAPSER_
+#define _REPEATCOLLAPSER_
+
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+
+namespace doggy
+{
+
+class LogFile;
+
+// RepeatCollapser在后台线程中合并连续重复的日志: 两条日志去掉序号和时间戳之后内容相同即视为重复
+// 一条日志从带有日志头部("[LEVEL]日期 时间 ")的行开始, 之后不带头部的行是它的延续(例如多行的调用栈),
+// 整条日志一起参与比较; 不属于任何带头部日志的行不参与比较, 并且打断重复
+// 只比较64位哈希值与长度, 不保留上一条日志的副本; 非重复的连续日志整段写出, 不产生额外拷贝
+class RepeatCollapser final
+{
+public:
+    explicit RepeatCollapser(bool sequence_numbers) : sequence_numbers_(sequence_numbers) {}
+
+    // 处理一段由完整日志组成的数据, 数据的结尾总是一条日志的结尾
+    void Write(std::string_view data, LogFile& output);
+    // 写出挂起的重复计数; forget为true时同时忘记上一条日志, 之后的日志不再与它比较
+    void Finish(LogFile& output, bool forget);
+
+private:
+    // 若line以日志头部开始, 计算它去掉"#序号 "和时间戳之后的哈希值, 并解析出序号
+    bool HashHeader(std::string_view line, size_t& hash, size_t& len, uint64_t& seq) const;
+    // 一条带头部的日志[begin, end)已经完整, 判断它是否与上一条重复
+    void EndRecord(std::string_view data, size_t begin, size_t end, size_t& run_begin, LogFile& output);
+
+private:
+    const bool sequence_numbers_;
+    bool has_last_ = false;
+    size_t last_hash_ = 0;
+    size_t last_len_ = 0;
+    // 正在累积的日志的哈希值、长度与序号
+    size_t cur_hash_ = 0;
+    size_t cur_len_ = 0;
+    uint64_t cur_seq_ = 0;
+    // 被合并的日志条数及其序号范围
+    uint64_t repeats_ = 0;
+    uint64_t first_seq_ = 0;
+    uint64_t last_seq_ = 0;
+};
+
+} // end namespace doggy
+
+#endif
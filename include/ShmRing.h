@@ -0,0 +1,87 @@
+#ifndef _SHMRING_
+#define _SHMRING_
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <string_view>
+
+namespace doggy
+{
+
+namespace detail
+{
+struct ShmRingHeader;
+}
+
+constexpr size_t DEFAULT_SHMRING_CAPACITY = 64 * 1024 * 1024;
+
+// ShmRing是位于POSIX共享内存中的多生产者/单消费者环形缓冲区
+// 应用进程中的线程通过Write无锁地写入日志记录, 独立的收集进程(log_collector)通过Drain
+// 读出记录并写入LogFile. 已经提交到环中的记录保存在共享内存里, 即使应用进程崩溃也不会丢失
+//
+// 内存布局: [ShmRingHeader][data: capacity字节]
+// 每条记录以16字节对齐, 由记录头和日志内容组成. 生产者先用CAS预留空间, 写入记录大小和自己的tid,
+// 再用CAS认领记录、拷贝内容, 最后用CAS提交; 消费者按顺序读取已提交的记录,
+// 读完后把记录所占空间清零再推进读位置, 因此空闲空间总是全零
+class ShmRing final
+{
+public:
+    // 创建或者附着到名为name的共享内存环, capacity会被向上取整为2的幂; 失败时返回nullptr
+    static std::shared_ptr<ShmRing> Create(const std::string& name, size_t capacity = DEFAULT_SHMRING_CAPACITY);
+    // 附着到已经存在的共享内存环; 失败时返回nullptr
+    static std::shared_ptr<ShmRing> Open(const std::string& name);
+    // 删除共享内存对象, 已经映射的进程不受影响
+    static void Unlink(const std::string& name);
+
+    ~ShmRing();
+    // 不允许拷贝
+    ShmRing(const ShmRing&) = delete;
+    ShmRing& operator=(const ShmRing&) = delete;
+
+    // 生产者: 写入一条记录, 环已满或记录过大时丢弃并返回false
+    bool Write(std::string_view logline);
+    // 作为Logger::SetOutput的输出目标
+    void Append(std::string_view logline) { Write(logline); }
+
+    // 消费者(只允许一个): 按顺序读出至多max_records条已提交的记录, 返回读出的条数
+    // 若某条记录在abandon_timeout内一直没有提交, 并且写入它的线程已经不存在, 认为生产者已经崩溃并跳过它;
+    // 线程仍然存在(只是被抢占或暂停)时继续等待, 不会释放生产者可能还要写入的空间.
+    // 生产者在预留空间之后、写入记录头之前崩溃时记录头全零, 超时后向后查找下一条记录的记录头并跳过这段空间.
+    // 判断依赖tid, 因此生产者与消费者需要位于同一个PID命名空间
+    using RecordFunc = std::function<void(std::string_view)>;
+    size_t Drain(const RecordFunc& func, size_t max_records = SIZE_MAX,
+                 std::chrono::milliseconds abandon_timeout = std::chrono::milliseconds(1000));
+
+    size_t Capacity() const noexcept { return capacity_; }
+    // 因环满而被丢弃的记录数
+    uint64_t Dropped() const noexcept;
+    // 因生产者崩溃而被跳过的记录数
+    uint64_t Abandoned() const noexcept;
+
+private:
+    ShmRing(detail::ShmRingHeader* header, size_t mapped_size);
+
+    static std::shared_ptr<ShmRing> Map(const std::string& name, int fd, size_t capacity, bool create);
+    // 消费者: 返回从pos起到下一个非零记录头(不超过limit)的字节数
+    uint64_t ResyncFrom(uint64_t pos, uint64_t limit) const;
+
+private:
+    detail::ShmRingHeader* header_;
+    char* data_;
+    size_t mapped_size_;
+    size_t capacity_;
+
+    // 消费者侧: 用于检测长时间未提交的记录
+    uint64_t stalled_pos_;
+    std::chrono::steady_clock::time_point stalled_since_;
+    // 停顿开始时的预留位置, 记录头丢失时只在这之前查找下一条记录
+    uint64_t stalled_reserved_;
+};
+
+} // end namespace doggy
+
+#endif
\ No newline at end of file
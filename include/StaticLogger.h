@@ -0,0 +1,92 @@
+#ifndef _STATICLOGGER_
+#define _STATICLOGGER_
+
+#include "Logger.h"
+#include "LogStream.h"
+
+#include <cstdlib>
+#include <string_view>
+#include <type_traits>
+#include <utility>
+
+namespace doggy
+{
+
+// SinkTraits决定StaticLogger为某种sink使用的单条日志缓冲区大小, 可以针对具体的sink类型特化:
+//   template<> struct doggy::SinkTraits<MySink> { static constexpr int BUFFER_SIZE = 4096; };
+template <typename Sink>
+struct SinkTraits
+{
+    static constexpr int BUFFER_SIZE = DEFAULT_LOGSTREAM_BUFFER_SIZE;
+};
+
+namespace detail
+{
+// 检测Sink是否提供感知日志级别的AppendLevel(std::string_view, LogLevel)
+template <typename Sink, typename = void>
+struct HasLevelAppend : std::false_type {};
+
+template <typename Sink>
+struct HasLevelAppend<Sink, std::void_t<decltype(std::declval<Sink&>().AppendLevel(std::string_view(), LogLevel::INFO))>>
+    : std::true_type {};
+}
+
+// StaticLogger是在编译期确定输出目标的日志前端
+// Logger通过std::function类型的output_func_输出日志, 每条日志至少经过一次类型擦除的调用;
+// StaticLogger直接调用Sink::Append, 编译器可以将其内联, 单条日志的缓冲区大小也可以按sink选择.
+// Sink需要提供Append(std::string_view), 例如AsyncLog, ShmRing; 若还提供AppendLevel(std::string_view, LogLevel), 则改为调用它.
+// Logger::SetOutput等运行期接口不受影响, 两种前端可以同时使用
+template <typename Sink, int BUFFER_SIZE = SinkTraits<Sink>::BUFFER_SIZE>
+class StaticLogger final
+{
+    static_assert(IsSupportedLogStreamSize(BUFFER_SIZE), "BasicLogStream is not instantiated for this BUFFER_SIZE");
+
+public:
+    StaticLogger(Sink& sink, SourceFile file, int line, LogLevel level)
+        : sink_(sink), level_(level)
+    {
+        detail::FormatHeader(stream_, level_, file, line);
+    }
+
+    StaticLogger(Sink& sink, SourceFile file, int line, LogLevel level, const char* func)
+        : StaticLogger(sink, file, line, level)
+    {
+        stream_ << func << "(): ";
+    }
+
+    // 不允许拷贝
+    StaticLogger(const StaticLogger&) = delete;
+    StaticLogger& operator=(const StaticLogger&) = delete;
+
+    ~StaticLogger()
+    {
+        stream_ << "\n";
+        if constexpr (detail::HasLevelAppend<Sink>::value)
+        {
+            sink_.AppendLevel(stream_.ToStringView(), level_);
+        }
+        else
+        {
+            sink_.Append(stream_.ToStringView());
+        }
+        if(level_ == LogLevel::FATAL)
+        {
+            Logger::flush_func_();
+            std::abort();
+        }
+    }
+
+    BasicLogStream<BUFFER_SIZE>& Stream() { return stream_; }
+
+private:
+    Sink& sink_;
+    LogLevel level_;
+    BasicLogStream<BUFFER_SIZE> stream_;
+};
+
+// 例: LOG_TO(async_log, doggy::LogLevel::INFO) << "hello";
+#define LOG_TO(sink, level) if (doggy::Logger::GetOutputLogLevel() <= level) doggy::StaticLogger<std::remove_reference_t<decltype(sink)>>(sink, __FILE__, __LINE__, level, __func__).Stream()
+
+} // end namespace doggy
+
+#endif
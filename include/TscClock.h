@@ -0,0 +1,86 @@
+#ifndef _TSCCLOCK_
+#define _TSCCLOCK_
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+namespace doggy
+{
+
+// tick与墙上时间(自epoch起的纳秒)之间的分段线性映射
+// base_ticks之后使用ns_per_tick, 之前沿用上一段的斜率prev_ns_per_tick; 每次重新校准都从上一段在
+// base_ticks处的取值继续(或者向前跳), 因此映射单调不减, 跨越校准点的日志时间戳不会倒退
+struct TscCalibration
+{
+    uint64_t base_ticks = 0;
+    int64_t base_ns = 0;
+    double ns_per_tick = 1.0;
+    double prev_ns_per_tick = 1.0;
+
+    int64_t ToNanos(uint64_t ticks) const
+    {
+        const int64_t delta = static_cast<int64_t>(ticks - base_ticks);
+        return base_ns + static_cast<int64_t>(static_cast<double>(delta) * (delta >= 0 ? ns_per_tick : prev_ns_per_tick));
+    }
+};
+
+// TscClock读取CPU时间戳计数器(TSC)作为低开销的时钟源
+// 前台线程只读取tick, 由后台线程借助周期性重新校准的映射将tick换算为墙上时间.
+// 只有在CPU声明TSC为invariant(频率恒定且跨核同步)时才可用, 否则调用者应退回clock_gettime
+class TscClock final
+{
+public:
+    TscClock() = delete;
+
+    // CPU是否提供invariant TSC, 结果只检测一次
+    static bool Invariant();
+
+    static uint64_t Now()
+    {
+#if defined(__x86_64__) || defined(__i386__)
+        return __rdtsc();
+#else
+        return 0;
+#endif
+    }
+
+    // 重新采样一对(tick, CLOCK_REALTIME), 以第一次采样为起点更新tick到纳秒的斜率
+    // CLOCK_REALTIME向前跳时映射随之向前跳; 向后调整(NTP回拨)时不倒退, 而是放慢映射的斜率逐渐追上
+    static void Recalibrate();
+    // 当前映射的拷贝, 首次调用时完成初始校准
+    static TscCalibration GetCalibration();
+};
+
+// 以"YYYY-MM-DD HH:MM:SS.nnnnnnnnn"格式化自epoch起的纳秒数, 返回写入的长度
+// 同一线程内相同秒的日期部分会被缓存, buf至少需要32字节
+size_t FormatWallTime(int64_t ns, char* buf);
+
+// TSC时间戳占位符: 日志头部中紧跟"[LEVEL]"之后的'@'和16位十六进制tick
+constexpr size_t TSC_PLACEHOLDER_SIZE = 17;
+
+// 写入TSC时间戳占位符, buf至少需要TSC_PLACEHOLDER_SIZE字节
+void FormatTscPlaceholder(uint64_t ticks, char* buf);
+
+// TscTimestampConverter把日志中的TSC时间戳占位符替换为墙上时间, 供后台线程和log_collector使用
+class TscTimestampConverter final
+{
+public:
+    // data中没有占位符时返回false且不修改out; 否则将替换后的完整内容写入out并返回true
+    bool Convert(std::string_view data, std::string& out);
+    // 重新校准并更新本对象使用的映射
+    void Recalibrate();
+
+private:
+    bool calibrated_ = false;
+    TscCalibration calibration_;
+};
+
+} // end namespace doggy
+
+#endif
\ No newline at end of file
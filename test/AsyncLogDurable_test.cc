@@ -0,0 +1,62 @@
+#include "../include/AsyncLog.h"
+
+#include <cstdio>
+#include <string>
+#include <thread>
+#include <vector>
+
+int main()
+{
+    // 8个线程各自调用AppendDurable, 组提交把它们合并到少量的fdatasync中
+    doggy::AsyncLogOptions options;
+    options.durable = true;
+    doggy::AsyncLog async_log {"./durable", options};
+
+    constexpr int THREADS = 8;
+    constexpr int RECORDS = 1000;
+    std::vector<std::thread> threads;
+    int failed[THREADS] = {};
+    for(int t = 0; t < THREADS; ++t)
+    {
+        threads.emplace_back([&async_log, &failed, t]
+        {
+            for(int i = 0; i < RECORDS; ++i)
+            {
+                std::string line = "thread " + std::to_string(t) + " record " + std::to_string(i) + "\n";
+                if(!async_log.AppendDurable(line))
+                {
+                    ++failed[t];
+                }
+            }
+        });
+    }
+    for(auto& thread : threads)
+    {
+        thread.join();
+    }
+
+    auto stats = async_log.GetSyncStats();
+    std::printf("syncs %lu, waiters %lu, max batch %lu, failures %lu\n",
+        static_cast<unsigned long>(stats.syncs), static_cast<unsigned long>(stats.waiters),
+        static_cast<unsigned long>(stats.max_batch), static_cast<unsigned long>(stats.failures));
+    int failures = 0;
+    for(int t = 0; t < THREADS; ++t)
+    {
+        failures += failed[t];
+    }
+    // 每个等待者都被某一次fdatasync唤醒, 并且并发的等待者被合并成批
+    if(failures != 0 || stats.failures != 0 || stats.waiters != THREADS * RECORDS || stats.syncs >= stats.waiters || stats.max_batch < 2)
+    {
+        std::fputs("durable group commit test failed\n", stderr);
+        return 1;
+    }
+
+    // 停止之后追加的日志不会再落盘
+    async_log.Stop();
+    if(async_log.AppendDurable("after stop\n"))
+    {
+        std::fputs("AppendDurable after Stop reported success\n", stderr);
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,22 @@
+#include "../include/AsyncLog.h"
+#include "../include/AsyncLogWriter.h"
+
+#include <string>
+
+int main()
+{
+    // 8个AsyncLog实例共享一个写线程, 各自写入./0 ~ ./7
+    auto writer = doggy::AsyncLogWriter::Create();
+    doggy::AsyncLogOptions options;
+    options.writer = writer;
+    std::unique_ptr<doggy::AsyncLog> logs[8];
+    for(int i = 0; i < 8; ++i)
+    {
+        logs[i] = std::make_unique<doggy::AsyncLog>("./" + std::to_string(i), options);
+    }
+    for(size_t n = 0; ; ++n)
+    {
+        logs[n % 8]->Append("this is a test log.\n");
+    }
+    return 0;
+}
@@ -4,7 +4,7 @@ int main()
 {
     while (true) 
     {
-        logger::LogFile::Create("./",false)->Append("This is a test log\n");    
+        doggy::LogFile::Create("./",false)->Append("This is a test log\n");    
     }
     return 0;
 }
\ No newline at end of file
@@ -1,4 +1,5 @@
 #include "Logger.h"
+#include "StaticLogger.h"
 #include "AsyncLog.h"
 
 #include <chrono>
@@ -11,8 +12,11 @@ using namespace doggy;
 int main()
 {
     AsyncLog asyc_log("./");
+    // 运行期指定输出目标
     Logger::SetOutput(std::bind(&AsyncLog::Append, &asyc_log, std::placeholders::_1));
     LOG_TRACE << "hello world";
+    // 编译期指定输出目标
+    LOG_TO(asyc_log, LogLevel::INFO) << "hello static world";
     std::this_thread::sleep_for(std::chrono::seconds(10));
     return 0;
-}
\ No newline at end of file
+}
@@ -0,0 +1,101 @@
+#include "../include/LogFile.h"
+#include "../include/RepeatCollapser.h"
+
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <initializer_list>
+#include <sstream>
+#include <string>
+#include <string_view>
+
+// 把若干段数据依次交给RepeatCollapser, 返回写入文件的内容
+std::string Collapse(bool sequence_numbers, std::initializer_list<std::string_view> chunks)
+{
+    const auto path = std::filesystem::temp_directory_path() / "RepeatCollapser_test.log";
+    std::filesystem::remove(path);
+    {
+        doggy::LogFile output(path);
+        doggy::RepeatCollapser collapser(sequence_numbers);
+        for(auto chunk : chunks)
+        {
+            collapser.Write(chunk, output);
+        }
+        collapser.Finish(output, true);
+    }
+    std::ifstream file(path);
+    std::stringstream content;
+    content << file.rdbuf();
+    std::filesystem::remove(path);
+    return content.str();
+}
+
+int Check(const char* name, const std::string& actual, std::string_view expected)
+{
+    if(actual == expected)
+    {
+        return 0;
+    }
+    std::fprintf(stderr, "%s failed, got:\n%s\nexpected:\n%.*s\n", name, actual.c_str(), static_cast<int>(expected.size()), expected.data());
+    return 1;
+}
+
+int main()
+{
+    int failures = 0;
+
+    // 时间戳不同、其余相同的连续日志被合并
+    failures += Check("single line",
+        Collapse(false, {"[INFO]2024-01-01 00:00:00.000001 1 main a.cc:1 hello\n"
+                         "[INFO]2024-01-01 00:00:00.000002 1 main a.cc:1 hello\n"
+                         "[INFO]2024-01-01 00:00:00.000003 1 main a.cc:1 hello\n"
+                         "[INFO]2024-01-01 00:00:00.000004 1 main a.cc:2 bye\n"}),
+        "[INFO]2024-01-01 00:00:00.000001 1 main a.cc:1 hello\n"
+        "last message repeated 2 times\n"
+        "[INFO]2024-01-01 00:00:00.000004 1 main a.cc:2 bye\n");
+
+    // 一条多行日志内部相同的延续行(空行、重复的栈帧)不被合并
+    const std::string_view trace =
+        "[ERROR]2024-01-01 00:00:00.000001 1 main a.cc:1 trace\n"
+        "\n"
+        "\n"
+        "    at frame\n"
+        "    at frame\n";
+    failures += Check("continuation lines", Collapse(false, {trace}), trace);
+
+    // 整条多行日志重复时作为一条日志合并, 计数写在它的结尾之后
+    failures += Check("multi-line record",
+        Collapse(false, {"[ERROR]2024-01-01 00:00:00.000001 1 main a.cc:1 trace\n    at frame\n",
+                         "[ERROR]2024-01-01 00:00:00.000002 1 main a.cc:1 trace\n    at frame\n"
+                         "[ERROR]2024-01-01 00:00:00.000003 1 main a.cc:1 trace\n    at other\n"}),
+        "[ERROR]2024-01-01 00:00:00.000001 1 main a.cc:1 trace\n    at frame\n"
+        "last message repeated 1 times\n"
+        "[ERROR]2024-01-01 00:00:00.000003 1 main a.cc:1 trace\n    at other\n");
+
+    // 不带头部的行不参与比较, 并且打断重复
+    failures += Check("headerless lines",
+        Collapse(false, {"raw\nraw\n",
+                         "[INFO]2024-01-01 00:00:00.000001 1 main a.cc:1 hello\n"
+                         "[INFO]2024-01-01 00:00:00.000002 1 main a.cc:1 hello\n",
+                         "raw\n",
+                         "[INFO]2024-01-01 00:00:00.000003 1 main a.cc:1 hello\n"}),
+        "raw\nraw\n"
+        "[INFO]2024-01-01 00:00:00.000001 1 main a.cc:1 hello\n"
+        "last message repeated 1 times\n"
+        "raw\n"
+        "[INFO]2024-01-01 00:00:00.000003 1 main a.cc:1 hello\n");
+
+    // 启用序号时计数附上被合并日志的序号区间
+    failures += Check("sequence numbers",
+        Collapse(true, {"#1 [WARN]2024-01-01 00:00:00.000001 1 main a.cc:1 hello\n"
+                        "#2 [WARN]2024-01-01 00:00:00.000002 1 main a.cc:1 hello\n",
+                        "#3 [WARN]2024-01-01 00:00:00.000003 1 main a.cc:1 hello\n"}),
+        "#1 [WARN]2024-01-01 00:00:00.000001 1 main a.cc:1 hello\n"
+        "last message repeated 2 times (records 2-3)\n");
+
+    if(failures == 0)
+    {
+        std::puts("RepeatCollapser test passed");
+    }
+    return failures == 0 ? 0 : 1;
+}
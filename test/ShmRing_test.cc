@@ -0,0 +1,12 @@
+#include "../include/ShmRing.h"
+
+int main()
+{
+    // 先启动 log_collector doggy_test ./ 再运行本程序
+    auto ring = doggy::ShmRing::Create("doggy_test");
+    while(ring)
+    {
+        ring->Append("this is a test log.\n");
+    }
+    return 0;
+}
@@ -0,0 +1,97 @@
+// log_collector: 将共享内存环(ShmRing)中的日志记录写入LogFile
+// 用法: log_collector <shm_name> <dir_path> [capacity_mb] [flush_interval_ms]
+// 应用进程通过Logger::SetOutput把日志写入同名的ShmRing, 日志I/O及其故障都发生在本进程中
+
+#include "ShmRing.h"
+#include "LogFile.h"
+#include "TscClock.h"
+
+#include <atomic>
+#include <chrono>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <string_view>
+#include <thread>
+
+using namespace doggy;
+
+namespace
+{
+std::atomic<bool> g_running{true};
+
+void HandleSignal(int)
+{
+    g_running.store(false);
+}
+}
+
+int main(int argc, char* argv[])
+{
+    if(argc < 3)
+    {
+        std::fprintf(stderr, "usage: %s <shm_name> <dir_path> [capacity_mb] [flush_interval_ms]\n", argv[0]);
+        return 1;
+    }
+    const std::string name = argv[1];
+    const std::filesystem::path dir_path = argv[2];
+    const size_t capacity = argc > 3 ? std::strtoull(argv[3], nullptr, 10) * 1024 * 1024 : DEFAULT_SHMRING_CAPACITY;
+    const auto flush_interval = std::chrono::milliseconds(argc > 4 ? std::atol(argv[4]) : 1000);
+
+    auto ring = ShmRing::Create(name, capacity);
+    if(!ring)
+    {
+        return 1;
+    }
+    std::signal(SIGINT, HandleSignal);
+    std::signal(SIGTERM, HandleSignal);
+
+    auto last_flush = std::chrono::steady_clock::now();
+    uint64_t reported_dropped = ring->Dropped();
+    uint64_t reported_abandoned = ring->Abandoned();
+    bool dirty = false;
+    // 应用进程使用TSC时钟时, 日志中是tick占位符; TSC在整机范围内同步, 可以在本进程中换算
+    TscTimestampConverter tsc_converter;
+    std::string converted;
+    // 收到退出信号后再排空一次
+    for(bool last_round = false; !last_round; )
+    {
+        last_round = !g_running.load();
+        auto output = LogFile::Create(dir_path, false);
+        size_t n = ring->Drain([&](std::string_view record)
+        {
+            output->Append(tsc_converter.Convert(record, converted) ? std::string_view(converted) : record);
+        }, 4096);
+        dirty = dirty || n > 0;
+
+        // 丢失统计与flush一样按间隔汇报, 避免持续过载时刷屏
+        auto now = std::chrono::steady_clock::now();
+        uint64_t dropped = ring->Dropped();
+        uint64_t abandoned = ring->Abandoned();
+        if((dropped != reported_dropped || abandoned != reported_abandoned) && (now - last_flush >= flush_interval || last_round))
+        {
+            char buf[256];
+            std::snprintf(buf, sizeof(buf), "log_collector: %lu records dropped by producers, %lu abandoned records skipped\n",
+                static_cast<unsigned long>(dropped - reported_dropped), static_cast<unsigned long>(abandoned - reported_abandoned));
+            std::fputs(buf, stderr);
+            output->Append(buf);
+            reported_dropped = dropped;
+            reported_abandoned = abandoned;
+            dirty = true;
+        }
+
+        if(dirty && (now - last_flush >= flush_interval || last_round))
+        {
+            output->Flush();
+            tsc_converter.Recalibrate();
+            last_flush = now;
+            dirty = false;
+        }
+        if(n == 0)
+        {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,519 @@
+// log_merge: 按日志头部的时间戳把多个日志分段合并成一个有序的输出
+// 用法: log_merge [-j threads] [-l level] [-f file[:line]]... [-o output] <log_file>...
+//   -j  扫描使用的线程数, 默认为CPU核数
+//   -l  只输出不低于该级别的日志, 例如 -l WARN
+//   -f  只输出来自该源文件(及行号)的日志, 可以指定多次
+//   -o  输出文件, 默认为标准输出
+// 输入文件以mmap方式读取并切分成若干块, 由多个线程并行地查找换行、解析时间戳和过滤,
+// 每块内部按时间戳排好序后, 最后用优先队列对所有块做k路归并.
+// 没有日志头部的行(多行日志的后续行、丢弃标记、重复计数等)跟随它前面的那条日志一起输出
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <queue>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+namespace
+{
+
+// 每个扫描任务处理的字节数
+constexpr size_t MERGE_CHUNK_SIZE = 32 * 1024 * 1024;
+// 输出缓冲区的大小
+constexpr size_t MERGE_OUTPUT_BUFFER_SIZE = 4 * 1024 * 1024;
+
+const char* const LOG_LEVEL_NAMES[] = {"TRACE", "DEBUG", "INFO", "WARN", "ERROR", "FATAL"};
+constexpr int NUM_LOG_LEVELS = 6;
+
+// 一条日志: 头部所在行以及跟随它的后续行
+struct Record
+{
+    // 自1970-01-01起的纳秒数, 按日志中的本地时间计算, 只用于比较先后
+    int64_t time;
+    const char* data;
+    size_t size;
+};
+
+// 一个输入文件的映射
+struct MappedFile
+{
+    const char* data = nullptr;
+    size_t size = 0;
+};
+
+// 一个扫描任务: 处理头部行起点位于[begin, end)内的日志, 输出为一个按时间排好序的归并段
+struct Chunk
+{
+    const MappedFile* file;
+    size_t begin;
+    size_t end;
+    std::vector<Record> records;
+};
+
+struct SourceFilter
+{
+    std::string file;
+    // 0表示不限行号
+    int line;
+};
+
+struct Filters
+{
+    int min_level = 0;
+    std::vector<SourceFilter> sources;
+};
+
+// 日志头部中解析出的字段
+struct Header
+{
+    int64_t time;
+    int level;
+    std::string_view file;
+    int line;
+};
+
+// 查找[p, end)中的第一个换行符, 找不到时返回end
+const char* FindNewline(const char* p, const char* end)
+{
+#if defined(__SSE2__)
+    const __m128i newline = _mm_set1_epi8('\n');
+    while(end - p >= 16)
+    {
+        __m128i block = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+        int mask = _mm_movemask_epi8(_mm_cmpeq_epi8(block, newline));
+        if(mask != 0)
+        {
+            return p + __builtin_ctz(mask);
+        }
+        p += 16;
+    }
+#endif
+    auto found = static_cast<const char*>(std::memchr(p, '\n', end - p));
+    return found ? found : end;
+}
+
+// 解析n位十进制数字, 遇到非数字时返回false
+inline bool ParseDigits(const char* p, int n, int& value)
+{
+    value = 0;
+    for(int i = 0; i < n; ++i)
+    {
+        if(p[i] < '0' || p[i] > '9')
+        {
+            return false;
+        }
+        value = value * 10 + (p[i] - '0');
+    }
+    return true;
+}
+
+// 公历日期到1970-01-01的天数
+int64_t DaysFromCivil(int y, int m, int d)
+{
+    y -= m <= 2;
+    const int64_t era = (y >= 0 ? y : y - 399) / 400;
+    const int64_t yoe = y - era * 400;
+    const int64_t doy = (153 * (m + (m > 2 ? -3 : 9)) + 2) / 5 + d - 1;
+    const int64_t doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+    return era * 146097 + doe - 719468;
+}
+
+// 跳过一个以空格结尾的字段, 返回字段之后的位置, 失败时返回nullptr
+inline const char* SkipField(const char* p, const char* end)
+{
+    auto space = static_cast<const char*>(std::memchr(p, ' ', end - p));
+    return space ? space + 1 : nullptr;
+}
+
+// 解析一行的日志头部: [#seq ][LEVEL]YYYY-MM-DD HH:MM:SS[.fraction] tid name [{context} ]file:line
+bool ParseHeader(const char* p, const char* end, Header& header)
+{
+    if(p < end && *p == '#')
+    {
+        p = SkipField(p, end);
+        if(!p)
+        {
+            return false;
+        }
+    }
+    if(end - p < 2 || *p != '[')
+    {
+        return false;
+    }
+    auto close = static_cast<const char*>(std::memchr(p, ']', std::min<size_t>(end - p, 8)));
+    if(!close)
+    {
+        return false;
+    }
+    std::string_view level(p + 1, close - p - 1);
+    header.level = -1;
+    for(int i = 0; i < NUM_LOG_LEVELS; ++i)
+    {
+        if(level == LOG_LEVEL_NAMES[i])
+        {
+            header.level = i;
+            break;
+        }
+    }
+    p = close + 1;
+    // "YYYY-MM-DD HH:MM:SS"
+    int year, month, day, hour, minute, second;
+    if(header.level < 0 || end - p < 19 || p[4] != '-' || p[7] != '-' || p[10] != ' ' || p[13] != ':' || p[16] != ':'
+       || !ParseDigits(p, 4, year) || !ParseDigits(p + 5, 2, month) || !ParseDigits(p + 8, 2, day)
+       || !ParseDigits(p + 11, 2, hour) || !ParseDigits(p + 14, 2, minute) || !ParseDigits(p + 17, 2, second))
+    {
+        return false;
+    }
+    p += 19;
+    int64_t nanos = 0;
+    if(p < end && *p == '.')
+    {
+        int64_t scale = 100000000;
+        for(++p; p < end && *p >= '0' && *p <= '9'; ++p)
+        {
+            nanos += (*p - '0') * scale;
+            scale /= 10;
+        }
+    }
+    header.time = ((DaysFromCivil(year, month, day) * 24 + hour) * 60 + minute) * 60 + second;
+    header.time = header.time * 1000000000 + nanos;
+
+    // " tid name [{context} ]file:line "
+    if(p >= end || *p != ' ')
+    {
+        return false;
+    }
+    ++p;
+    p = SkipField(p, end);
+    p = p ? SkipField(p, end) : nullptr;
+    if(p && p < end && *p == '{')
+    {
+        auto brace = static_cast<const char*>(std::memchr(p, '}', end - p));
+        p = brace && brace + 1 < end && brace[1] == ' ' ? brace + 2 : nullptr;
+    }
+    header.file = std::string_view();
+    header.line = 0;
+    if(p)
+    {
+        auto field_end = static_cast<const char*>(std::memchr(p, ' ', end - p));
+        std::string_view source(p, (field_end ? field_end : end) - p);
+        auto colon = source.rfind(':');
+        if(colon != std::string_view::npos)
+        {
+            header.file = source.substr(0, colon);
+            for(char c : source.substr(colon + 1))
+            {
+                if(c < '0' || c > '9')
+                {
+                    break;
+                }
+                header.line = header.line * 10 + (c - '0');
+            }
+        }
+    }
+    return true;
+}
+
+bool Accept(const Header& header, const Filters& filters)
+{
+    if(header.level < filters.min_level)
+    {
+        return false;
+    }
+    if(filters.sources.empty())
+    {
+        return true;
+    }
+    for(const auto& source : filters.sources)
+    {
+        if(header.file == source.file && (source.line == 0 || header.line == source.line))
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+void ScanChunk(Chunk& chunk, const Filters& filters)
+{
+    const char* const base = chunk.file->data;
+    const char* const file_end = base + chunk.file->size;
+    const char* p = base + chunk.begin;
+    // 块的起点不是行首时, 从下一行开始
+    if(chunk.begin > 0 && p[-1] != '\n')
+    {
+        p = FindNewline(p, file_end);
+        p = p < file_end ? p + 1 : p;
+    }
+
+    const bool unfiltered = filters.min_level == 0 && filters.sources.empty();
+    bool in_record = false;
+    bool keep = false;
+    Header header;
+    while(p < file_end)
+    {
+        const char* eol = FindNewline(p, file_end);
+        const char* next = eol < file_end ? eol + 1 : eol;
+        if(ParseHeader(p, eol, header))
+        {
+            // 头部行起点超出本块的日志由下一个块处理
+            if(p >= base + chunk.end)
+            {
+                break;
+            }
+            keep = Accept(header, filters);
+            if(keep)
+            {
+                chunk.records.push_back(Record{header.time, p, static_cast<size_t>(next - p)});
+            }
+            in_record = true;
+        }
+        else if(in_record)
+        {
+            if(keep)
+            {
+                chunk.records.back().size += next - p;
+            }
+        }
+        else if(chunk.begin == 0)
+        {
+            // 文件开头没有头部的行: 不过滤时原样输出在最前面
+            if(!unfiltered)
+            {
+                in_record = true;
+                keep = false;
+            }
+            else
+            {
+                chunk.records.push_back(Record{INT64_MIN, p, static_cast<size_t>(next - p)});
+                in_record = true;
+                keep = true;
+            }
+        }
+        else if(p >= base + chunk.end)
+        {
+            break;
+        }
+        // 否则是上一个块中最后一条日志的后续行, 跳过
+        p = next;
+    }
+
+    // 同一文件内的日志未必有序, 例如高优先级通道的日志先于同一轮的普通日志写出
+    auto by_time = [](const Record& a, const Record& b){ return a.time < b.time; };
+    if(!std::is_sorted(chunk.records.begin(), chunk.records.end(), by_time))
+    {
+        std::stable_sort(chunk.records.begin(), chunk.records.end(), by_time);
+    }
+}
+
+bool MapFile(const char* path, MappedFile& file)
+{
+    int fd = ::open(path, O_RDONLY | O_CLOEXEC);
+    struct stat st{};
+    if(fd < 0 || ::fstat(fd, &st) != 0)
+    {
+        std::fprintf(stderr, "log_merge: cannot open %s: %s\n", path, std::strerror(errno));
+        if(fd >= 0)
+        {
+            ::close(fd);
+        }
+        return false;
+    }
+    file.size = st.st_size;
+    if(file.size > 0)
+    {
+        void* addr = ::mmap(nullptr, file.size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if(addr == MAP_FAILED)
+        {
+            std::fprintf(stderr, "log_merge: cannot map %s: %s\n", path, std::strerror(errno));
+            ::close(fd);
+            return false;
+        }
+        ::madvise(addr, file.size, MADV_SEQUENTIAL);
+        file.data = static_cast<const char*>(addr);
+    }
+    ::close(fd);
+    return true;
+}
+
+int Usage(const char* program)
+{
+    std::fprintf(stderr, "usage: %s [-j threads] [-l level] [-f file[:line]]... [-o output] <log_file>...\n", program);
+    return 1;
+}
+
+} // end namespace
+
+int main(int argc, char* argv[])
+{
+    Filters filters;
+    size_t threads = std::max(1u, std::thread::hardware_concurrency());
+    const char* output_path = nullptr;
+    std::vector<const char*> inputs;
+    for(int i = 1; i < argc; ++i)
+    {
+        std::string_view arg = argv[i];
+        if((arg == "-j" || arg == "-l" || arg == "-f" || arg == "-o") && i + 1 >= argc)
+        {
+            return Usage(argv[0]);
+        }
+        if(arg == "-j")
+        {
+            threads = std::max(1L, std::atol(argv[++i]));
+        }
+        else if(arg == "-l")
+        {
+            std::string_view level = argv[++i];
+            filters.min_level = -1;
+            for(int l = 0; l < NUM_LOG_LEVELS; ++l)
+            {
+                if(level == LOG_LEVEL_NAMES[l])
+                {
+                    filters.min_level = l;
+                }
+            }
+            if(filters.min_level < 0)
+            {
+                std::fprintf(stderr, "log_merge: unknown level %s\n", argv[i]);
+                return 1;
+            }
+        }
+        else if(arg == "-f")
+        {
+            std::string source = argv[++i];
+            auto colon = source.rfind(':');
+            int line = colon == std::string::npos ? 0 : std::atoi(source.c_str() + colon + 1);
+            filters.sources.push_back(SourceFilter{line > 0 ? source.substr(0, colon) : source, line});
+        }
+        else if(arg == "-o")
+        {
+            output_path = argv[++i];
+        }
+        else
+        {
+            inputs.push_back(argv[i]);
+        }
+    }
+    if(inputs.empty())
+    {
+        return Usage(argv[0]);
+    }
+
+    std::vector<MappedFile> files(inputs.size());
+    for(size_t i = 0; i < inputs.size(); ++i)
+    {
+        if(!MapFile(inputs[i], files[i]))
+        {
+            return 1;
+        }
+    }
+
+    // 切分扫描任务, 任务的顺序即归并时相同时间戳的先后顺序
+    std::vector<Chunk> chunks;
+    for(const auto& file : files)
+    {
+        for(size_t begin = 0; begin < file.size; begin += MERGE_CHUNK_SIZE)
+        {
+            chunks.push_back(Chunk{&file, begin, std::min(file.size, begin + MERGE_CHUNK_SIZE), {}});
+        }
+    }
+
+    std::atomic<size_t> next_chunk{0};
+    std::vector<std::thread> workers;
+    for(size_t t = 0; t < std::min(threads, chunks.size()); ++t)
+    {
+        workers.emplace_back([&]
+        {
+            for(size_t i = next_chunk++; i < chunks.size(); i = next_chunk++)
+            {
+                ScanChunk(chunks[i], filters);
+            }
+        });
+    }
+    for(auto& worker : workers)
+    {
+        worker.join();
+    }
+
+    FILE* output = output_path ? std::fopen(output_path, "w") : stdout;
+    if(!output)
+    {
+        std::fprintf(stderr, "log_merge: cannot open %s: %s\n", output_path, std::strerror(errno));
+        return 1;
+    }
+    // 进程退出前stdout可能仍然使用该缓冲区, 因此使用静态存储
+    static char output_buffer[MERGE_OUTPUT_BUFFER_SIZE];
+    std::setvbuf(output, output_buffer, _IOFBF, sizeof(output_buffer));
+
+    // k路归并: 堆中保存每个归并段的当前位置, 时间戳相同时按归并段的顺序输出
+    struct Cursor
+    {
+        int64_t time;
+        size_t chunk;
+        size_t index;
+    };
+    auto later = [](const Cursor& a, const Cursor& b)
+    {
+        return a.time != b.time ? a.time > b.time : a.chunk > b.chunk;
+    };
+    std::priority_queue<Cursor, std::vector<Cursor>, decltype(later)> heap(later);
+    for(size_t i = 0; i < chunks.size(); ++i)
+    {
+        if(!chunks[i].records.empty())
+        {
+            heap.push(Cursor{chunks[i].records[0].time, i, 0});
+        }
+    }
+    while(!heap.empty())
+    {
+        Cursor cursor = heap.top();
+        heap.pop();
+        const auto& records = chunks[cursor.chunk].records;
+        const Record& record = records[cursor.index];
+        std::fwrite(record.data, 1, record.size, output);
+        // 文件的最后一行可能没有换行符
+        if(record.data[record.size - 1] != '\n')
+        {
+            std::fputc('\n', output);
+        }
+        if(++cursor.index < records.size())
+        {
+            cursor.time = records[cursor.index].time;
+            heap.push(cursor);
+        }
+    }
+
+    bool ok = std::fflush(output) == 0;
+    if(output != stdout)
+    {
+        ok = std::fclose(output) == 0 && ok;
+    }
+    for(const auto& file : files)
+    {
+        if(file.data)
+        {
+            ::munmap(const_cast<char*>(file.data), file.size);
+        }
+    }
+    if(!ok)
+    {
+        std::fputs("log_merge: write failed\n", stderr);
+        return 1;
+    }
+    return 0;
+}